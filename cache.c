@@ -0,0 +1,297 @@
+/* On-disk cache of parsed statement trees.  An entry is named by the hash of the source
+   bytes, seeded with the fingerprints of the syntax and the sub-syntaxes it uses, so
+   changing either the source or any of the rules misses.  The entry is a header, followed
+   by the bencoded statement tree.  The header holds the key and the hash of the encoding,
+   so a truncated or damaged entry is a miss.  Hits are mapped, checked and decoded in
+   place.
+
+   Hits touch the entry's modification time.  When storing an entry takes the directory over
+   its size limit, the least recently used entries are removed. */
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#include "pa.h"
+
+#define PA_CACHE_MAGIC 0x43323450 // "P42C"
+#define PA_CACHE_VERSION 2 // Changed when the statement encoding changes
+#define PA_CACHE_SUFFIX ".p42c"
+
+// The header of a cache entry, in native byte order, as the cache is not shared between
+// machines.
+typedef struct {
+    uint32 magic;
+    uint32 version;
+    uint64 key;
+    uint64 length; // Bytes of encoding after the header
+    uint64 hash; // Hash of the encoding
+} paCacheHeader;
+
+// A cache entry found while evicting.
+typedef struct {
+    char *fileName;
+    uint64 size;
+    time_t mtime;
+} paCacheEntry;
+
+static char *paCacheDirectory;
+static uint64 paCacheMaxBytes;
+
+// Use a cache directory of at most maxBytes bytes when parsing files with
+// paParseCachedFile, creating it if needed.  A NULL directory turns caching off.
+void paSetCacheDirectory(
+    char *dirName,
+    uint64 maxBytes)
+{
+    if(paCacheDirectory != NULL) {
+        utFree(paCacheDirectory);
+        paCacheDirectory = NULL;
+    }
+    if(dirName != NULL) {
+        if(mkdir(dirName, 0777) != 0 && errno != EEXIST) {
+            utWarning("Unable to create cache directory %s", dirName);
+            return;
+        }
+        paCacheDirectory = utAllocString(dirName);
+    }
+    paCacheMaxBytes = maxBytes;
+}
+
+// Return the path of the cache entry for the key.  This returns a utBuffer.
+static char *findEntryPath(
+    uint64 key)
+{
+    return utSprintf("%s/%016llx%s", paCacheDirectory, (unsigned long long)key,
+        PA_CACHE_SUFFIX);
+}
+
+// Look up the key in the cache.  Return paStatementNull on a miss.
+static paStatement loadEntry(
+    paSyntax syntax,
+    uint64 key,
+    char *path)
+{
+    vaRegion region = vaFileRegionCreate(path);
+    paCacheHeader header;
+    paStatement statement = paStatementNull;
+    uint8 *bytes;
+    uint64 length;
+
+    if(region == NULL) {
+        return paStatementNull;
+    }
+    bytes = vaRegionGetBytes(region, &length);
+    if(length > sizeof(paCacheHeader)) {
+        memcpy(&header, bytes, sizeof(paCacheHeader));
+        bytes += sizeof(paCacheHeader);
+        length -= sizeof(paCacheHeader);
+        if(header.magic == PA_CACHE_MAGIC && header.version == PA_CACHE_VERSION &&
+                header.key == key && header.length == length &&
+                vaHash64(bytes, length) == header.hash) {
+            statement = paStatementBdecodeRegion(syntax, region, bytes);
+            // Mark the entry as recently used.
+            utime(path, NULL);
+        }
+    }
+    vaRegionUnref(region);
+    return statement;
+}
+
+// Compare cache entries by modification time, oldest first.
+static int compareEntries(
+    const void *entry1Ptr,
+    const void *entry2Ptr)
+{
+    const paCacheEntry *entry1 = (const paCacheEntry *)entry1Ptr;
+    const paCacheEntry *entry2 = (const paCacheEntry *)entry2Ptr;
+
+    return entry1->mtime < entry2->mtime? -1 : entry1->mtime > entry2->mtime;
+}
+
+// Remove the least recently used entries until the cache fits in its size limit.
+static void evictEntries(void)
+{
+    DIR *dir = opendir(paCacheDirectory);
+    struct dirent *dirEntry;
+    struct stat status;
+    paCacheEntry *entries;
+    uint32 numEntries = 0, entriesSize = 32, xEntry;
+    uint64 totalSize = 0;
+    size_t nameLength, suffixLength = strlen(PA_CACHE_SUFFIX);
+    char *path;
+
+    if(dir == NULL) {
+        return;
+    }
+    entries = utNewA(paCacheEntry, entriesSize);
+    while((dirEntry = readdir(dir)) != NULL) {
+        nameLength = strlen(dirEntry->d_name);
+        if(nameLength <= suffixLength ||
+                strcmp(dirEntry->d_name + nameLength - suffixLength, PA_CACHE_SUFFIX)) {
+            continue;
+        }
+        path = utSprintf("%s/%s", paCacheDirectory, dirEntry->d_name);
+        if(stat(path, &status) != 0) {
+            continue;
+        }
+        if(numEntries == entriesSize) {
+            entriesSize <<= 1;
+            utResizeArray(entries, entriesSize);
+        }
+        entries[numEntries].fileName = utAllocString(dirEntry->d_name);
+        entries[numEntries].size = status.st_size;
+        entries[numEntries].mtime = status.st_mtime;
+        totalSize += status.st_size;
+        numEntries++;
+    }
+    closedir(dir);
+    if(totalSize > paCacheMaxBytes) {
+        qsort(entries, numEntries, sizeof(paCacheEntry), compareEntries);
+        for(xEntry = 0; xEntry < numEntries && totalSize > paCacheMaxBytes; xEntry++) {
+            if(unlink(utSprintf("%s/%s", paCacheDirectory, entries[xEntry].fileName)) == 0) {
+                totalSize -= entries[xEntry].size;
+            }
+        }
+    }
+    for(xEntry = 0; xEntry < numEntries; xEntry++) {
+        utFree(entries[xEntry].fileName);
+    }
+    utFree(entries);
+}
+
+// Store the statement tree in the cache.  The entry is written to a temporary file and
+// renamed, so readers never see a partial entry.
+static void storeEntry(
+    paStatement statement,
+    uint64 key,
+    char *path)
+{
+    vaSink sink = vaMemorySinkCreate();
+    paCacheHeader header;
+    char *tempPath;
+    uint8 *bytes;
+    FILE *file;
+    bool passed;
+
+    paBencodeStatement(sink, statement);
+    bytes = vaSinkGetBytes(sink, &header.length);
+    header.magic = PA_CACHE_MAGIC;
+    header.version = PA_CACHE_VERSION;
+    header.key = key;
+    header.hash = vaHash64(bytes, header.length);
+    tempPath = utAllocString(utSprintf("%s.%d.tmp", path, (int)getpid()));
+    file = fopen(tempPath, "wb");
+    if(file != NULL) {
+        passed = fwrite(&header, sizeof(paCacheHeader), 1, file) == 1 &&
+            fwrite(bytes, 1, header.length, file) == header.length;
+        passed = fclose(file) == 0 && passed;
+        if(!passed || rename(tempPath, path) != 0) {
+            unlink(tempPath);
+        }
+    }
+    vaSinkDestroy(sink);
+    utFree(tempPath);
+    evictEntries();
+}
+
+// Return true if the syntax is among those found so far.
+static bool syntaxFound(
+    paSyntax *syntaxes,
+    uint32 numSyntaxes,
+    paSyntax syntax)
+{
+    uint32 xSyntax;
+
+    for(xSyntax = 0; xSyntax < numSyntaxes; xSyntax++) {
+        if(syntaxes[xSyntax] == syntax) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Return the number of syntaxes.
+static uint32 countSyntaxes(void)
+{
+    paSyntax syntax;
+    uint32 numSyntaxes = 0;
+
+    paForeachRootSyntax(paTheRoot, syntax) {
+        numSyntaxes++;
+    } paEndRootSyntax;
+    return numSyntaxes;
+}
+
+// Return the fingerprint of the syntax combined with those of the sub-syntaxes its staterules
+// switch to, directly or through other sub-syntaxes.  Sub-syntaxes are found by name, as the
+// parser and decoder find them.
+static uint64 findCombinedFingerprint(
+    paSyntax syntax)
+{
+    // The syntax may not be in the root, so leave room for one more.
+    uint32 numSyntaxes = countSyntaxes() + 1;
+    paSyntax syntaxes[numSyntaxes];
+    uint32 numFound = 1, xSyntax;
+    paStaterule staterule;
+    paSyntax subSyntax;
+    uint64 fingerprint;
+    vaHasher hasher;
+    utSym sym;
+
+    syntaxes[0] = syntax;
+    vaHasherStart(&hasher, 0);
+    for(xSyntax = 0; xSyntax < numFound; xSyntax++) {
+        syntax = syntaxes[xSyntax];
+        fingerprint = paSyntaxGetFingerprint(syntax);
+        vaHasherAdd(&hasher, (uint8 *)&fingerprint, sizeof(uint64));
+        paForeachSyntaxStaterule(syntax, staterule) {
+            sym = paStateruleGetSubSyntaxSym(staterule);
+            if(sym != utSymNull) {
+                subSyntax = paRootFindSyntax(paTheRoot, sym);
+                if(subSyntax != paSyntaxNull && numFound < numSyntaxes &&
+                        !syntaxFound(syntaxes, numFound, subSyntax)) {
+                    syntaxes[numFound++] = subSyntax;
+                }
+            }
+        } paEndSyntaxStaterule;
+    }
+    return vaHasherFinish(&hasher);
+}
+
+// Parse the source file, using the cache directory if one is set.  The key is the hash of
+// the file's bytes, seeded with the combined fingerprint of the syntax and its sub-syntaxes.
+// On a miss, the file is parsed as usual, and the result is stored.
+paStatement paParseCachedFile(
+    paSyntax syntax,
+    char *fileName)
+{
+    vaRegion region;
+    paStatement statement;
+    uint64 key, length;
+    uint8 *bytes;
+    vaHasher hasher;
+    char *path;
+
+    if(paCacheDirectory == NULL || (region = vaFileRegionCreate(fileName)) == NULL) {
+        return paParseSourceFile(syntax, fileName);
+    }
+    bytes = vaRegionGetBytes(region, &length);
+    vaHasherStart(&hasher, findCombinedFingerprint(syntax));
+    vaHasherAdd(&hasher, bytes, length);
+    key = vaHasherFinish(&hasher);
+    vaRegionUnref(region);
+    // Copy the path, as utSprintf buffers are reused.
+    path = utAllocString(findEntryPath(key));
+    statement = loadEntry(syntax, key, path);
+    if(statement == paStatementNull) {
+        statement = paParseSourceFile(syntax, fileName);
+        if(statement != paStatementNull) {
+            storeEntry(statement, key, path);
+        }
+    }
+    utFree(path);
+    return statement;
+}
@@ -0,0 +1,326 @@
+/* Incremental reparsing.  A document holds its text and statement tree.  Statements are
+   line and block delimited, so an edit can only damage the top-level statements whose
+   lines it touches.  Only those lines are relexed and reparsed, the new statements are
+   spliced into the tree, and line numbers after the edit are shifted.
+
+   If the damaged region does not parse on its own, for example because the edit added or
+   removed a brace, the whole document is reparsed.  If that fails too, the tree is left
+   as it was and marked stale, and the next edit reparses everything. */
+
+#include "pa.h"
+
+struct paDocumentStruct {
+    paSyntax syntax;
+    paStatement topStatement;
+    uchar *text;
+    uint32 length, size;
+    bool stale; // The statement tree does not match the text
+};
+
+// Count the newlines in the bytes.
+static uint32 countLines(
+    uchar *bytes,
+    uint32 length)
+{
+    uchar *end = bytes + length;
+    uint32 numLines = 0;
+
+    while((bytes = (uchar *)memchr(bytes, '\n', end - bytes)) != NULL) {
+        numLines++;
+        bytes++;
+    }
+    return numLines;
+}
+
+// Find the start of the line, numbered from 1.  Lines past the end start at the end.
+static uchar *findLineStart(
+    uchar *text,
+    uint32 length,
+    uint32 lineNum)
+{
+    uchar *end = text + length;
+
+    while(--lineNum != 0) {
+        text = (uchar *)memchr(text, '\n', end - text);
+        if(text == NULL) {
+            return end;
+        }
+        text++;
+    }
+    return text;
+}
+
+// Reparse the whole document.  Return false if it has a syntax error.
+static bool parseAll(
+    paDocument document)
+{
+    paStatement topStatement;
+
+    if(utSetjmp()) {
+        paParseAbort();
+        document->stale = true;
+        return false;
+    }
+    topStatement = paParseBuffer(document->syntax, document->text, document->length);
+    utUnsetjmp();
+    if(document->topStatement != paStatementNull) {
+        paStatementDestroy(document->topStatement);
+    }
+    document->topStatement = topStatement;
+    document->stale = false;
+    return true;
+}
+
+// Create a document, and parse it.
+paDocument paDocumentCreate(
+    paSyntax syntax,
+    uchar *bytes,
+    uint32 length)
+{
+    paDocument document = utNew(struct paDocumentStruct);
+
+    memset(document, 0, sizeof(struct paDocumentStruct));
+    document->syntax = syntax;
+    document->size = length + 1;
+    document->text = utNewA(uchar, document->size);
+    memcpy(document->text, bytes, length);
+    document->length = length;
+    parseAll(document);
+    return document;
+}
+
+// Destroy the document and its statement tree.
+void paDocumentDestroy(
+    paDocument document)
+{
+    if(document->topStatement != paStatementNull) {
+        paStatementDestroy(document->topStatement);
+    }
+    utFree(document->text);
+    utFree(document);
+}
+
+// Return the document's statement tree.
+paStatement paDocumentGetStatement(
+    paDocument document)
+{
+    return document->topStatement;
+}
+
+// Return the document's current text.
+uchar *paDocumentGetText(
+    paDocument document,
+    uint32 *length)
+{
+    *length = document->length;
+    return document->text;
+}
+
+// Apply the edit to the document text.
+static void replaceText(
+    paDocument document,
+    uint32 start,
+    uint32 removeLength,
+    uchar *replacement,
+    uint32 replacementLength)
+{
+    uint32 newLength = document->length - removeLength + replacementLength;
+    uint32 tail = document->length - start - removeLength;
+
+    if(newLength > document->size) {
+        document->size = newLength + (newLength >> 1);
+        utResizeArray(document->text, document->size);
+    }
+    memmove(document->text + start + replacementLength,
+        document->text + start + removeLength, tail);
+    memcpy(document->text + start, replacement, replacementLength);
+    document->length = newLength;
+}
+
+// Shift the line numbers of an expr tree.
+static void shiftExprLines(
+    paExpr expr,
+    int32 delta)
+{
+    paExpr subExpr;
+
+    paExprSetLineNum(expr, paExprGetLineNum(expr) + delta);
+    paForeachExprExpr(expr, subExpr) {
+        shiftExprLines(subExpr, delta);
+    } paEndExprExpr;
+}
+
+// Shift the line numbers of a statement, its exprs and its sub-statements.
+static void shiftStatementLines(
+    paStatement statement,
+    int32 delta)
+{
+    paStatement subStatement;
+    paExpr expr;
+
+    paStatementSetFirstLine(statement, paStatementGetFirstLine(statement) + delta);
+    paStatementSetLastLine(statement, paStatementGetLastLine(statement) + delta);
+    paForeachStatementExpr(statement, expr) {
+        shiftExprLines(expr, delta);
+    } paEndStatementExpr;
+    paForeachStatementStatement(statement, subStatement) {
+        shiftStatementLines(subStatement, delta);
+    } paEndStatementStatement;
+}
+
+// Reparse the lines from firstLine through lastLine of the new text, and replace the
+// top-level statements from firstStatement through lastStatement with the result.  Return
+// false if the lines do not parse on their own.
+static bool reparseRegion(
+    paDocument document,
+    uint32 firstLine,
+    uint32 lastLine,
+    paStatement firstStatement,
+    paStatement lastStatement)
+{
+    paStatement topStatement = document->topStatement;
+    paStatement newTop, statement, nextStatement, prevStatement;
+    uchar *start = findLineStart(document->text, document->length, firstLine);
+    uchar *end = findLineStart(document->text, document->length, lastLine + 1);
+
+    if(utSetjmp()) {
+        paParseAbort();
+        return false;
+    }
+    newTop = paParseBufferFromLine(document->syntax, start, end - start, firstLine - 1);
+    utUnsetjmp();
+    if(firstStatement != paStatementNull) {
+        prevStatement = paStatementGetPrevStatementStatement(firstStatement);
+        statement = firstStatement;
+        utDo {
+            nextStatement = paStatementGetNextStatementStatement(statement);
+            paStatementDestroy(statement);
+        } utWhile(statement != lastStatement) {
+            statement = nextStatement;
+        } utRepeat;
+    } else {
+        // Nothing was damaged, so find where the new lines go.
+        prevStatement = paStatementNull;
+        paForeachStatementStatement(topStatement, statement) {
+            if(paStatementGetLastLine(statement) >= firstLine) {
+                break;
+            }
+            prevStatement = statement;
+        } paEndStatementStatement;
+    }
+    paSafeForeachStatementStatement(newTop, statement) {
+        paStatementRemoveStatement(newTop, statement);
+        if(prevStatement == paStatementNull) {
+            paStatementInsertStatement(topStatement, statement);
+        } else {
+            paStatementInsertAfterStatement(topStatement, prevStatement, statement);
+        }
+        prevStatement = statement;
+    } paEndSafeStatementStatement;
+    paStatementDestroy(newTop);
+    return true;
+}
+
+// Replace removeLength bytes at start with the replacement, and reparse only the damaged
+// top-level statements.  Return false if the document now has a syntax error.
+bool paDocumentEdit(
+    paDocument document,
+    uint32 start,
+    uint32 removeLength,
+    uchar *replacement,
+    uint32 replacementLength)
+{
+    paStatement topStatement = document->topStatement;
+    paStatement firstStatement = paStatementNull, lastStatement = paStatementNull;
+    paStatement statement, prevStatement;
+    uint32 editFirstLine, editLastLine, firstLine, lastLine, removedLines;
+    int32 delta;
+
+    utAssert(start + removeLength <= document->length);
+    editFirstLine = countLines(document->text, start) + 1;
+    removedLines = countLines(document->text + start, removeLength);
+    editLastLine = editFirstLine + removedLines;
+    delta = (int32)countLines(replacement, replacementLength) - (int32)removedLines;
+    replaceText(document, start, removeLength, replacement, replacementLength);
+    if(document->stale) {
+        return parseAll(document);
+    }
+    // Find the statements touching the edited lines.  A statement ending on a line that a
+    // damaged statement starts on, as in "} else {", is damaged too.
+    firstLine = editFirstLine;
+    lastLine = editLastLine;
+    paForeachStatementStatement(topStatement, statement) {
+        if(paStatementGetFirstLine(statement) > lastLine) {
+            break;
+        }
+        if(paStatementGetLastLine(statement) >= firstLine) {
+            if(firstStatement == paStatementNull) {
+                firstStatement = statement;
+            }
+            lastStatement = statement;
+            if(paStatementGetLastLine(statement) > lastLine) {
+                lastLine = paStatementGetLastLine(statement);
+            }
+        }
+    } paEndStatementStatement;
+    if(firstStatement != paStatementNull) {
+        if(paStatementGetFirstLine(firstStatement) < firstLine) {
+            firstLine = paStatementGetFirstLine(firstStatement);
+        }
+        prevStatement = paStatementGetPrevStatementStatement(firstStatement);
+        while(prevStatement != paStatementNull &&
+                paStatementGetLastLine(prevStatement) >= firstLine) {
+            firstStatement = prevStatement;
+            firstLine = paStatementGetFirstLine(prevStatement);
+            prevStatement = paStatementGetPrevStatementStatement(prevStatement);
+        }
+    }
+    // Statements after the damage move before the reparse numbers the new ones.
+    statement = lastStatement != paStatementNull?
+        paStatementGetNextStatementStatement(lastStatement) : paStatementNull;
+    if(lastStatement == paStatementNull) {
+        paForeachStatementStatement(topStatement, statement) {
+            if(paStatementGetFirstLine(statement) > lastLine) {
+                break;
+            }
+        } paEndStatementStatement;
+    }
+    if(delta != 0) {
+        for(; statement != paStatementNull;
+                statement = paStatementGetNextStatementStatement(statement)) {
+            shiftStatementLines(statement, delta);
+        }
+    }
+    if(!reparseRegion(document, firstLine, lastLine + delta, firstStatement,
+            lastStatement)) {
+        return parseAll(document);
+    }
+    return true;
+}
+
+// Check that editing a statement after a multi-line block comment gives the same tree as
+// parsing the edited text from scratch.  The comment's lines must be counted, or the edit
+// is mapped to the wrong statement.
+void paDocumentSelfTest(void)
+{
+    char *text = "/* A block comment\n   on two lines */\na: b\nc: d\n";
+    char *edited = "/* A block comment\n   on two lines */\na: b\nc: e\n";
+    paDocument document, expected;
+    paStatement statement;
+
+    document = paDocumentCreate(paParseSyntax, (uchar *)text, strlen(text));
+    expected = paDocumentCreate(paParseSyntax, (uchar *)edited, strlen(edited));
+    statement = paStatementGetLastStatementStatement(paDocumentGetStatement(document));
+    if(paStatementGetFirstLine(statement) != 4) {
+        utExit("Statement after a block comment is on line %u, not 4",
+            paStatementGetFirstLine(statement));
+    }
+    if(!paDocumentEdit(document, strlen(text) - 2, 1, (uchar *)"e", 1) ||
+            paStatementHash(paDocumentGetStatement(document), 0) !=
+            paStatementHash(paDocumentGetStatement(expected), 0)) {
+        utExit("Edit after a block comment does not match a full reparse");
+    }
+    paDocumentDestroy(document);
+    paDocumentDestroy(expected);
+    printf("Passed document edits\n");
+}
@@ -13,6 +13,7 @@ static uchar *paLine;
 static uchar *paText;
 static size_t paTextSize, paTextPos;
 static uint32 paParenDepth, paBracketDepth;
+static uint32 paTokenLine; // Line the current token starts on
 static bool paLastWasNewline;
 
 // Print out an error message and exit.
@@ -45,6 +46,40 @@ void paLexerStart(void)
 // Stop the lexer.
 void paLexerStop(void)
 {
+    free(paText);
+    paText = NULL;
+}
+
+// Save the lexer state so another parse can run.
+void paLexerSaveState(
+    paParseState *state)
+{
+    state->line = paLine;
+    state->text = paText;
+    state->textSize = paTextSize;
+    state->textPos = paTextPos;
+    state->parenDepth = paParenDepth;
+    state->bracketDepth = paBracketDepth;
+    state->tokenLine = paTokenLine;
+    state->lastWasNewline = paLastWasNewline;
+    state->lineNum = paLineNum;
+    state->readLine = paReadLine;
+}
+
+// Restore lexer state saved with paLexerSaveState.
+void paLexerRestoreState(
+    paParseState *state)
+{
+    paLine = state->line;
+    paText = state->text;
+    paTextSize = state->textSize;
+    paTextPos = state->textPos;
+    paParenDepth = state->parenDepth;
+    paBracketDepth = state->bracketDepth;
+    paTokenLine = state->tokenLine;
+    paLastWasNewline = state->lastWasNewline;
+    paLineNum = state->lineNum;
+    paReadLine = state->readLine;
 }
 
 // Just print the contents of the token
@@ -100,7 +135,7 @@ static inline paToken paTokenCreate(
 
     paTokenSetType(token, type);
     paTokenSetText(token, text, strlen((char *)text) + 1);
-    paTokenSetLineNum(token, paLineNum);
+    paTokenSetLineNum(token, paTokenLine);
     return token;
 }
 
@@ -208,7 +243,11 @@ static inline bool readComment(void)
         while(depth != 0) {
             if(*paLine == '\0') {
                 addAscii('\n');
-                paLine = utf8ReadLine(paFile);
+                paLine = paReadLine();
+                if(paLine == NULL) {
+                    utError("Line %u: unterminated comment", paLineNum);
+                }
+                paLineNum++;
             } else if(*paLine == '*' && paLine[1] == '/') {
                 paLine += 2;
                 depth--;
@@ -391,20 +430,21 @@ static paToken lexRawToken(void)
 {
     paTextPos = 0;
     if(paLine == NULL) {
-        paLine = utf8ReadLine(paFile);
+        paLine = paReadLine();
         if(paLine == NULL) {
             return paTokenNull;
         }
         paLineNum++;
     }
     while(lineIsSlash()) {
-        paLine = utf8ReadLine(paFile);
+        paLine = paReadLine();
         if(paLine == NULL) {
             return paTokenNull;
         }
         paLineNum++;
     }
     paLine = skipSpace(paLine);
+    paTokenLine = paLineNum;
     if(*paLine == '\0') {
         paLine = NULL;
         return paTokenCreate(PA_TOK_NEWLINE, (uchar *)"\n");
@@ -436,10 +476,10 @@ static void skipBlankLines(void)
     if(paLine != NULL) {
         return; // Nothing to skip.
     }
-    paLine = utf8ReadLine(paFile);
+    paLine = paReadLine();
     while(paLine != NULL && lineIsBlank()) {
         paLineNum++;
-        paLine = utf8ReadLine(paFile);
+        paLine = paReadLine();
     }
     if(paLine != NULL) {
         paLineNum++;
@@ -1,5 +1,7 @@
 #include "pa.h"
 
+#define PA_CACHE_BYTES (256llu << 20) // Size limit of the parse cache directory
+
 // Create the root module statement.
 void start(
     char *arg0)
@@ -31,23 +33,56 @@ int main(
 {
     paSyntax syntax;
     paStatement statement;
+    char *socketPath = NULL;
     int xArg = 1;
 
     start(argv[0]);
     if(utSetjmp()) {
         printf("Error occured.\n");
+        paCloseSourceFile();
         stop();
         return 1;
     }
-    if(argc < 2) {
-        printf("Usage: parse42 rulesFile [dataFile...]\n");
+    while(xArg < argc && argv[xArg][0] == '-') {
+        if(!strcmp(argv[xArg], "-p")) {
+            paUsePipeline = true;
+        } else if(!strcmp(argv[xArg], "-i")) {
+            vaSetHashConsing(true);
+        } else if(!strcmp(argv[xArg], "-s") && xArg + 1 < argc) {
+            socketPath = argv[++xArg];
+        } else if(!strcmp(argv[xArg], "-c") && xArg + 1 < argc) {
+            paSetCacheDirectory(argv[++xArg], PA_CACHE_BYTES);
+        } else if(!strcmp(argv[xArg], "-t")) {
+            paDocumentSelfTest();
+            paSerializeSelfTest();
+            utUnsetjmp();
+            stop();
+            return 0;
+        } else {
+            printf("Unknown option %s\n", argv[xArg]);
+            return 1;
+        }
+        xArg++;
+    }
+    if(socketPath != NULL) {
+        paServe(socketPath);
+    }
+    if(argc - xArg < 1) {
+        printf("Usage: parse42 [-i] [-p] [-c cacheDir] rulesFile [dataFile...]\n"
+            "       parse42 -s socketPath\n"
+            "       parse42 -t\n"
+            "    -c  Cache parsed data files in cacheDir\n"
+            "    -i  Share one object between equal values\n"
+            "    -p  Read input on a separate thread\n"
+            "    -s  Serve parse requests on a Unix-domain socket\n"
+            "    -t  Run the self-tests\n");
         return 1;
     }
-    statement = paParseSourceFile(paParseSyntax, argv[1]);
+    statement = paParseSourceFile(paParseSyntax, argv[xArg]);
     syntax = paSyntaxCreate(utSymCreate(utReplaceSuffix(argv[xArg], "")));
     paProcessSyntaxStatement(syntax, statement);
-    for(xArg = 2; xArg < argc; xArg++) {
-        statement = paParseSourceFile(syntax, argv[xArg]);
+    for(xArg++; xArg < argc; xArg++) {
+        statement = paParseCachedFile(syntax, argv[xArg]);
     }
     utUnsetjmp();
     stop();
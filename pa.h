@@ -2,6 +2,10 @@
 
 // Main routines
 paStatement paParseSourceFile(paSyntax syntax, char *fileName);
+void paCloseSourceFile(void);
+paStatement paParseBuffer(paSyntax syntax, uchar *bytes, uint64 length);
+paStatement paParseBufferFromLine(paSyntax syntax, uchar *bytes, uint64 length,
+    uint32 firstLineNum);
 void paCreateBuiltins(void);
 
 // Statement methods.
@@ -19,6 +23,7 @@ void paPrintExpr(paExpr expr);
 void paSyntaxStart(void);
 void paSyntaxStop(void);
 paSyntax paSyntaxCreate(utSym name);
+paSyntax paSyntaxCreateFromBuffer(utSym name, uchar *bytes, uint64 length);
 void paProcessSyntaxStatement(paSyntax targetSyntax, paStatement statement);
 paPrecedenceGroup paPrecedenceGroupCreate(paSyntax syntax, paOperator operator);
 paStaterule paStateruleCreate(paSyntax syntax, utSym name, bool hasBlock,
@@ -45,13 +50,80 @@ extern paRoot paTheRoot;
 void paLexerStart(void);
 void paLexerStop(void);
 paStatement paParse();
+void paParseAbort(void);
 paToken paLex(void);
 void paPrintToken(paToken token);
 void paPrintNodeExpr(paNodeExpr nodeExpr);
 void paError(paToken token, char *message, ...);
 void paExprError(paExpr expr, char *message, ...);
 
+// Line readers return the next validated UTF-8 line without its newline, or NULL at the end
+// of input.
+typedef uchar *(*paLineReader)(void);
+
+// Parser state, saved while a push parser waits for more input.
+typedef struct {
+    uchar *line, *text;
+    size_t textSize, textPos;
+    uint32 parenDepth, bracketDepth;
+    uint32 tokenLine;
+    bool lastWasNewline;
+    uint32 lineNum;
+    paLineReader readLine;
+    paStatement topStatement, outerStatement, prevStatement;
+    paToken nextBeginToken;
+    paSyntax topSyntax, currentSyntax;
+    uint32 firstLine, lastLine;
+    bool debug;
+    paToken *tokens; // Tokens read so far on the current line
+    uint32 numTokens, tokenSize;
+} paParseState;
+
+void paLexerSaveState(paParseState *state);
+void paLexerRestoreState(paParseState *state);
+void paSaveParseState(paParseState *state);
+void paRestoreParseState(paParseState *state);
+
+// Push parser: the caller feeds input as it arrives rather than the parser reading it.
+typedef struct paParserStruct *paParser;
+paParser paParserCreate(paSyntax syntax);
+void paParserDestroy(paParser parser);
+void paParserFeed(paParser parser, uchar *bytes, uint32 length);
+paStatement paParserFinish(paParser parser);
+
+// Documents are held in memory and reparsed incrementally as they are edited.
+typedef struct paDocumentStruct *paDocument;
+paDocument paDocumentCreate(paSyntax syntax, uchar *bytes, uint32 length);
+void paDocumentDestroy(paDocument document);
+bool paDocumentEdit(paDocument document, uint32 start, uint32 removeLength,
+    uchar *replacement, uint32 replacementLength);
+paStatement paDocumentGetStatement(paDocument document);
+uchar *paDocumentGetText(paDocument document, uint32 *length);
+void paDocumentSelfTest(void);
+
+// Bencoded statement trees, and the parse server that returns them.
+void paBencodeStatement(vaSink sink, paStatement statement);
+uchar *paStatementBencode(paStatement statement, uint64 *length);
+paStatement paStatementBdecode(paSyntax syntax, uint8 *bytes);
+bool paSaveStatement(paStatement statement, char *fileName);
+paStatement paStatementBdecodeRegion(paSyntax syntax, vaRegion region, uint8 *bytes);
+paStatement paLoadStatement(paSyntax syntax, char *fileName);
+uint64 paStatementHash(paStatement statement, uint64 seed);
+void paSerializeSelfTest(void);
+void paServe(char *socketPath);
+
+// On-disk parse cache
+void paSetCacheDirectory(char *dirName, uint64 maxBytes);
+paStatement paParseCachedFile(paSyntax syntax, char *fileName);
+
+// Pipelined line reader
+void paPipelineStart(FILE *file);
+void paPipelineStop(void);
+uchar *paPipelineReadLine(void);
+
 extern paSyntax paParseSyntax, paCurrentSyntax;
+extern paLineReader paReadLine;
+extern bool paUsePipeline;
 extern FILE *paFile;
 extern uint32 paFileSize, paLineNum;
 
@@ -27,10 +27,11 @@
 
 #include "pa.h"
 
-static paStatement paOuterStatement, paPrevStatement;
+static paStatement paTopStatement, paOuterStatement, paPrevStatement;
 static bool paDebug;
 static paToken paNextBeginToken;
 static paSyntax paTopSyntax;
+static uint32 paFirstLine, paLastLine; // Lines spanned by the current statement
 
 // Print out an error message and exit.
 void paExprError(
@@ -92,6 +93,10 @@ static bool readOneLine(void)
     }
     while(token != paTokenNull && paTokenGetType(token) == PA_TOK_END) {
         printf("Finished sub-statements\n");
+        if(paStatementGetStatement(paOuterStatement) == paStatementNull) {
+            paError(token, "Unmatched }");
+        }
+        paStatementSetLastLine(paOuterStatement, paTokenGetLineNum(token));
         paOuterStatement = paStatementGetStatement(paOuterStatement);
         staterule = paStatementGetStaterule(paOuterStatement);
         if(staterule == paStateruleNull) {
@@ -119,10 +124,14 @@ static bool readOneLine(void)
             // Every character should be matched by some other token
             paError(token, "Illegal character in input");
         }
+        if(paSyntaxGetUsedToken(paCurrentSyntax) == 0) {
+            paFirstLine = paTokenGetLineNum(token);
+        }
         paSyntaxAppendToken(paCurrentSyntax, token);
         paPrintToken(token);
         token = paLex();
     }
+    paLastLine = token == paTokenNull? paLineNum : paTokenGetLineNum(token);
     if(token != paTokenNull) {
         if(paTokenGetType(token) == PA_TOK_BEGIN) {
             paNextBeginToken = token;
@@ -681,6 +690,60 @@ static paStatement parseStatement(void)
     return statement;
 }
 
+// Save the parser state, including the tokens read so far on the current line, so that
+// another parse can run.
+void paSaveParseState(
+    paParseState *state)
+{
+    uint32 numTokens = paSyntaxGetUsedToken(paCurrentSyntax);
+    uint32 xToken;
+    paToken token;
+
+    paLexerSaveState(state);
+    state->topStatement = paTopStatement;
+    state->outerStatement = paOuterStatement;
+    state->prevStatement = paPrevStatement;
+    state->nextBeginToken = paNextBeginToken;
+    state->topSyntax = paTopSyntax;
+    state->currentSyntax = paCurrentSyntax;
+    state->firstLine = paFirstLine;
+    state->lastLine = paLastLine;
+    state->debug = paDebug;
+    if(numTokens > state->tokenSize) {
+        state->tokenSize = numTokens + (numTokens >> 1);
+        utResizeArray(state->tokens, state->tokenSize);
+    }
+    for(xToken = 0; xToken < numTokens; xToken++) {
+        token = paSyntaxGetiToken(paCurrentSyntax, xToken);
+        paSyntaxRemoveToken(paCurrentSyntax, token);
+        state->tokens[xToken] = token;
+    }
+    paSyntaxSetUsedToken(paCurrentSyntax, 0);
+    state->numTokens = numTokens;
+}
+
+// Restore parser state saved with paSaveParseState.
+void paRestoreParseState(
+    paParseState *state)
+{
+    uint32 xToken;
+
+    paLexerRestoreState(state);
+    paTopStatement = state->topStatement;
+    paOuterStatement = state->outerStatement;
+    paPrevStatement = state->prevStatement;
+    paNextBeginToken = state->nextBeginToken;
+    paTopSyntax = state->topSyntax;
+    paCurrentSyntax = state->currentSyntax;
+    paFirstLine = state->firstLine;
+    paLastLine = state->lastLine;
+    paDebug = state->debug;
+    for(xToken = 0; xToken < state->numTokens; xToken++) {
+        paSyntaxAppendToken(paCurrentSyntax, state->tokens[xToken]);
+    }
+    state->numTokens = 0;
+}
+
 // Parse an L42 file.  This is done one statement at a time.  Statements are
 // NEWLINE terminated.  Sub-statements are between BEGIN and END tokens.
 paStatement paParse(
@@ -690,6 +753,7 @@ paStatement paParse(
 
     paTopSyntax = syntax;
     paCurrentSyntax = syntax;
+    paTopStatement = topStatement;
     paOuterStatement = topStatement;
     paLexerStart();
     paNextBeginToken = paTokenNull;
@@ -699,8 +763,31 @@ paStatement paParse(
     paIdentSym = utSymCreate("ident");
     while(readOneLine()) {
         paPrevStatement = parseStatement();
+        paStatementSetFirstLine(paPrevStatement, paFirstLine);
+        paStatementSetLastLine(paPrevStatement, paLastLine);
         destroyLineTokens();
     }
+    if(paOuterStatement != topStatement) {
+        utError("Line %u: missing }", paLineNum);
+    }
     paLexerStop();
+    paTopStatement = paStatementNull;
     return topStatement;
 }
+
+// Clean up after an error interrupted paParse, so the next parse starts fresh.  The
+// partially built statement tree is destroyed.
+void paParseAbort(void)
+{
+    destroyLineTokens();
+    if(paTopStatement != paStatementNull) {
+        paStatementDestroy(paTopStatement);
+        paTopStatement = paStatementNull;
+    }
+    if(paNextBeginToken != paTokenNull) {
+        paTokenDestroy(paNextBeginToken);
+        paNextBeginToken = paTokenNull;
+    }
+    paLexerStop();
+    paCloseSourceFile();
+}
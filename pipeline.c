@@ -0,0 +1,172 @@
+/* Pipelined line reader.  A reader thread does the file I/O and UTF-8 validation, and
+   hands batches of validated lines to the lexer through a single-producer/single-consumer
+   ring buffer.  This overlaps reading with lexing and parsing on a second core.
+
+   Only lines are pipelined, not tokens: keyword recognition depends on the active syntax,
+   which the parser switches when it enters and leaves blocks, so the lexer has to stay in
+   lockstep with the parser.  Tokens are also DataDraw objects, which may only be
+   allocated from the parser thread.  For the same reason, batches are allocated with malloc
+   rather than the ddutil allocator, which the reader thread must not touch. */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include "pa.h"
+
+#define PA_NUM_BATCHES 8
+#define PA_BATCH_LINES 256
+#define PA_BATCH_BYTES (1 << 16)
+
+typedef struct {
+    uchar *text; // Zero-terminated lines, one after the other
+    uint32 size, used;
+    uint32 numLines;
+    bool endOfFile;
+} paLineBatch;
+
+static paLineBatch paBatches[PA_NUM_BATCHES];
+static uint32 paHead, paTail; // Written only by the producer and consumer respectively
+static pthread_t paReaderThread;
+static FILE *paPipelineFile;
+static bool paPipelineRunning;
+static paLineBatch *paCurrentBatch;
+static uint32 paBatchPos, paBatchLine;
+
+// Wait for the other side of the ring buffer.  Spin briefly, then yield the core.
+static inline void waitForRing(
+    uint32 *spins)
+{
+    if(++*spins > 64) {
+        sched_yield();
+    }
+}
+
+// Add a validated line to the batch.
+static void addLineToBatch(
+    paLineBatch *batch,
+    uchar *line)
+{
+    uint32 length = strlen((char *)line) + 1;
+
+    if(batch->used + length > batch->size) {
+        batch->size = (batch->size << 1) + length;
+        batch->text = realloc(batch->text, batch->size);
+        if(batch->text == NULL) {
+            utExit("Out of memory reading lines");
+        }
+    }
+    memcpy(batch->text + batch->used, line, length);
+    batch->used += length;
+    batch->numLines++;
+}
+
+// The producer thread: read lines until end of file, publishing full batches.
+static void *readLines(
+    void *arg)
+{
+    paLineBatch *batch;
+    uchar *line;
+    uint32 spins;
+    bool endOfFile = false;
+
+    while(!endOfFile) {
+        spins = 0;
+        while(paHead - __atomic_load_n(&paTail, __ATOMIC_ACQUIRE) == PA_NUM_BATCHES) {
+            waitForRing(&spins);
+        }
+        batch = paBatches + paHead % PA_NUM_BATCHES;
+        batch->used = 0;
+        batch->numLines = 0;
+        while(batch->numLines < PA_BATCH_LINES && batch->used < PA_BATCH_BYTES) {
+            line = utf8ReadLine(paPipelineFile);
+            if(line == NULL) {
+                endOfFile = true;
+                break;
+            }
+            addLineToBatch(batch, line);
+        }
+        batch->endOfFile = endOfFile;
+        __atomic_store_n(&paHead, paHead + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+// Start the reader thread on the file.
+void paPipelineStart(
+    FILE *file)
+{
+    uint32 xBatch;
+
+    for(xBatch = 0; xBatch < PA_NUM_BATCHES; xBatch++) {
+        paBatches[xBatch].size = PA_BATCH_BYTES;
+        paBatches[xBatch].text = malloc(PA_BATCH_BYTES);
+    }
+    paHead = 0;
+    paTail = 0;
+    paCurrentBatch = NULL;
+    paPipelineFile = file;
+    if(pthread_create(&paReaderThread, NULL, readLines, NULL) != 0) {
+        utExit("Unable to start the reader thread");
+    }
+    paPipelineRunning = true;
+}
+
+// Wait for the reader thread to finish, and free the batches.  The parser may stop before
+// end of file, so drain the ring buffer until the reader has published its last batch.
+void paPipelineStop(void)
+{
+    uint32 xBatch;
+    uint32 spins = 0;
+    bool endOfFile = paCurrentBatch != NULL && paCurrentBatch->endOfFile;
+
+    if(!paPipelineRunning) {
+        return;
+    }
+    while(!endOfFile) {
+        if(__atomic_load_n(&paHead, __ATOMIC_ACQUIRE) == paTail) {
+            waitForRing(&spins);
+        } else {
+            endOfFile = paBatches[paTail % PA_NUM_BATCHES].endOfFile;
+            __atomic_store_n(&paTail, paTail + 1, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_join(paReaderThread, NULL);
+    for(xBatch = 0; xBatch < PA_NUM_BATCHES; xBatch++) {
+        free(paBatches[xBatch].text);
+        paBatches[xBatch].text = NULL;
+    }
+    paPipelineRunning = false;
+    paPipelineFile = NULL;
+}
+
+// Return the next line from the reader thread, or NULL at end of file.  The line stays
+// valid until the next call.
+uchar *paPipelineReadLine(void)
+{
+    uchar *line;
+    uint32 spins = 0;
+
+    if(paCurrentBatch != NULL && paBatchLine == paCurrentBatch->numLines) {
+        if(paCurrentBatch->endOfFile) {
+            return NULL;
+        }
+        // Done with this batch: hand it back to the producer.
+        paCurrentBatch = NULL;
+        __atomic_store_n(&paTail, paTail + 1, __ATOMIC_RELEASE);
+    }
+    if(paCurrentBatch == NULL) {
+        while(__atomic_load_n(&paHead, __ATOMIC_ACQUIRE) == paTail) {
+            waitForRing(&spins);
+        }
+        paCurrentBatch = paBatches + paTail % PA_NUM_BATCHES;
+        paBatchPos = 0;
+        paBatchLine = 0;
+        if(paCurrentBatch->numLines == 0) {
+            return NULL;
+        }
+    }
+    line = paCurrentBatch->text + paBatchPos;
+    paBatchPos += strlen((char *)line) + 1;
+    paBatchLine++;
+    return line;
+}
@@ -0,0 +1,188 @@
+/* Push parser.  The caller feeds input in arbitrary chunks as it arrives, for example from
+   a socket, and the parser runs in a coroutine that suspends when it runs out of complete
+   lines instead of blocking on getc.  Many streams can be parsed on one thread this way.
+
+   The parser keeps its state in globals, so it is saved when a coroutine suspends and
+   restored when it resumes.  An error raised with utError still longjmps to the caller's
+   utSetjmp, abandoning the coroutine, so the caller must then call paParseAbort and destroy
+   the parser. */
+
+#include "pa.h"
+#include "thread.h"
+
+struct paParserStruct {
+    coThread thread;
+    paSyntax syntax;
+    paStatement topStatement;
+    paParseState state;
+    uchar *input; // Bytes fed but not yet read by the lexer
+    uint32 inputSize, inputPos, inputUsed;
+    uchar *line;
+    uint32 lineSize;
+    bool endOfInput;
+    bool suspended; // True while waiting for input, with the parse state saved
+};
+
+static paParser paCurrentParser;
+
+// Give control back to the feeder until more input arrives.
+static void waitForInput(
+    paParser parser)
+{
+    paSaveParseState(&parser->state);
+    parser->suspended = true;
+    coYield();
+    parser->suspended = false;
+    paRestoreParseState(&parser->state);
+}
+
+// Copy a line out of the input buffer, and validate it.
+static uchar *copyLine(
+    paParser parser,
+    uchar *start,
+    uint32 length)
+{
+    if(length + 1 > parser->lineSize) {
+        parser->lineSize = length + 1 + (length >> 1);
+        utResizeArray(parser->line, parser->lineSize);
+    }
+    memcpy(parser->line, start, length);
+    parser->line[length] = '\0';
+    utf8ValidateLine(parser->line);
+    return parser->line;
+}
+
+// Line reader for push parsers.  This suspends the coroutine until a whole line has been
+// fed.  A final line without a newline is returned once the input is finished.
+static uchar *readPushedLine(void)
+{
+    paParser parser = paCurrentParser;
+    uchar *start, *end;
+    uint32 length;
+
+    utDo {
+        start = parser->input + parser->inputPos;
+        end = (uchar *)memchr(start, '\n', parser->inputUsed - parser->inputPos);
+    } utWhile(end == NULL && !parser->endOfInput) {
+        waitForInput(parser);
+    } utRepeat;
+    if(end == NULL) {
+        if(parser->inputPos == parser->inputUsed) {
+            return NULL;
+        }
+        end = parser->input + parser->inputUsed;
+        length = end - start;
+        parser->inputPos += length;
+    } else {
+        length = end - start;
+        parser->inputPos += length + 1;
+    }
+    return copyLine(parser, start, length);
+}
+
+// The body of the parser coroutine.
+static void runParser(
+    void *arg)
+{
+    paParser parser = (paParser)arg;
+
+    paReadLine = readPushedLine;
+    paLineNum = 0;
+    parser->topStatement = paParse(parser->syntax);
+    // paParse stopped the lexer, which freed the text buffer.
+    parser->state.text = NULL;
+}
+
+// Create a push parser for the syntax.
+paParser paParserCreate(
+    paSyntax syntax)
+{
+    paParser parser = utNew(struct paParserStruct);
+
+    memset(parser, 0, sizeof(struct paParserStruct));
+    parser->syntax = syntax;
+    parser->thread = coThreadCreate(runParser, parser, 0);
+    parser->inputSize = 256;
+    parser->input = utNewA(uchar, parser->inputSize);
+    parser->lineSize = 256;
+    parser->line = utNewA(uchar, parser->lineSize);
+    return parser;
+}
+
+// Free memory used by the parser.  Statements it built are not destroyed.  The lexer's
+// text and tokens are only owned here if the parser was left waiting for input.
+void paParserDestroy(
+    paParser parser)
+{
+    uint32 xToken;
+
+    if(coGetCurrentThread() == parser->thread) {
+        // An error longjmped out of the coroutine.
+        coAbort();
+    }
+    coThreadDestroy(parser->thread);
+    if(parser->suspended) {
+        free(parser->state.text);
+        for(xToken = 0; xToken < parser->state.numTokens; xToken++) {
+            paTokenDestroy(parser->state.tokens[xToken]);
+        }
+    }
+    utFree(parser->state.tokens);
+    utFree(parser->input);
+    utFree(parser->line);
+    utFree(parser);
+}
+
+// Let the parser coroutine run until it needs more input, or finishes.
+static void resumeParser(
+    paParser parser)
+{
+    if(coThreadFinished(parser->thread)) {
+        return;
+    }
+    paCurrentParser = parser;
+    coSwitchToThread(parser->thread);
+}
+
+// Add bytes to the end of the input buffer, first dropping what has been read.
+static void appendInput(
+    paParser parser,
+    uchar *bytes,
+    uint32 length)
+{
+    uint32 unread = parser->inputUsed - parser->inputPos;
+
+    if(parser->inputPos > 0) {
+        memmove(parser->input, parser->input + parser->inputPos, unread);
+        parser->inputPos = 0;
+        parser->inputUsed = unread;
+    }
+    if(unread + length > parser->inputSize) {
+        parser->inputSize = unread + length + (parser->inputSize >> 1);
+        utResizeArray(parser->input, parser->inputSize);
+    }
+    memcpy(parser->input + unread, bytes, length);
+    parser->inputUsed += length;
+}
+
+// Feed bytes to the parser.  Statements are parsed as soon as their lines are complete.
+void paParserFeed(
+    paParser parser,
+    uchar *bytes,
+    uint32 length)
+{
+    appendInput(parser, bytes, length);
+    // Don't bother switching to the parser until it has a whole line to work on.
+    if(memchr(bytes, '\n', length) != NULL) {
+        resumeParser(parser);
+    }
+}
+
+// Signal the end of input, finish parsing, and return the top statement.
+paStatement paParserFinish(
+    paParser parser)
+{
+    parser->endOfInput = true;
+    resumeParser(parser);
+    return parser->topStatement;
+}
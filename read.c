@@ -2,6 +2,11 @@
 
 paRoot paTheRoot;
 FILE *paFile;
+paLineReader paReadLine;
+bool paUsePipeline; // Read and validate lines on a second thread
+static uchar *paBuffer, *paBufferEnd; // Input for paParseBuffer
+static uchar *paBufferLine;
+static uint32 paBufferLineSize;
 // Must be set before parsing so that the parser knows where to add stuff.
 uint32 paFileSize, paLineNum;
 paSyntax paParseSyntax, paCurrentSyntax;
@@ -258,6 +263,12 @@ void paCreateBuiltins(void)
     paPrintSyntax(syntax);
 }
 
+// Read the next line from paFile.
+static uchar *readFileLine(void)
+{
+    return utf8ReadLine(paFile);
+}
+
 // Parse a command definition file.
 paStatement paParseSourceFile(
     paSyntax syntax,
@@ -271,8 +282,101 @@ paStatement paParseSourceFile(
         return paStatementNull;
     }
     paLineNum = 0;
+    if(paUsePipeline) {
+        paPipelineStart(paFile);
+        paReadLine = paPipelineReadLine;
+    } else {
+        paReadLine = readFileLine;
+    }
     statement = paParse(syntax);
-    fclose(paFile);
-    paFile = NULL;
+    paCloseSourceFile();
     return statement;
 }
+
+// Stop the reader thread, if any, and close the source file.  This is also called when an
+// error interrupts the parse, so the reader is not left running on a stale file.
+void paCloseSourceFile(void)
+{
+    paPipelineStop();
+    if(paFile != NULL) {
+        fclose(paFile);
+        paFile = NULL;
+    }
+}
+
+// Read the next line from the buffer passed to paParseBuffer.  The line is copied so it
+// can be zero-terminated and validated without writing to the caller's bytes.  A final
+// line without a newline is still returned.
+static uchar *readBufferLine(void)
+{
+    uchar *start = paBuffer;
+    uchar *end;
+    uint32 length;
+
+    if(start == paBufferEnd) {
+        return NULL;
+    }
+    end = (uchar *)memchr(start, '\n', paBufferEnd - start);
+    if(end == NULL) {
+        end = paBufferEnd;
+        paBuffer = paBufferEnd;
+    } else {
+        paBuffer = end + 1;
+    }
+    length = end - start;
+    if(length + 1 > paBufferLineSize) {
+        paBufferLineSize = length + 1 + (length >> 1);
+        if(paBufferLine == NULL) {
+            paBufferLine = utNewA(uchar, paBufferLineSize);
+        } else {
+            utResizeArray(paBufferLine, paBufferLineSize);
+        }
+    }
+    memcpy(paBufferLine, start, length);
+    paBufferLine[length] = '\0';
+    utf8ValidateLine(paBufferLine);
+    return paBufferLine;
+}
+
+// Parse input already in memory, numbering lines after firstLineNum.  This is used to
+// reparse part of a document.
+paStatement paParseBufferFromLine(
+    paSyntax syntax,
+    uchar *bytes,
+    uint64 length,
+    uint32 firstLineNum)
+{
+    paStatement statement;
+
+    paBuffer = bytes;
+    paBufferEnd = bytes + length;
+    paReadLine = readBufferLine;
+    paLineNum = firstLineNum;
+    statement = paParse(syntax);
+    paBuffer = NULL;
+    paBufferEnd = NULL;
+    return statement;
+}
+
+// Parse input already in memory, such as text received over IPC.
+paStatement paParseBuffer(
+    paSyntax syntax,
+    uchar *bytes,
+    uint64 length)
+{
+    return paParseBufferFromLine(syntax, bytes, length, 0);
+}
+
+// Create a syntax from rules held in memory, in the format of l42Syntax.rules.
+paSyntax paSyntaxCreateFromBuffer(
+    utSym name,
+    uchar *bytes,
+    uint64 length)
+{
+    paStatement statement = paParseBuffer(paParseSyntax, bytes, length);
+    paSyntax syntax = paSyntaxCreate(name);
+
+    paProcessSyntaxStatement(syntax, statement);
+    paStatementDestroy(statement);
+    return syntax;
+}
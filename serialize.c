@@ -0,0 +1,376 @@
+/* Bencode statement trees, so they can be sent to other processes, or saved and loaded
+   instead of reparsing the source.
+
+   A statement is encoded as the tuple
+
+       (staterule, firstLine, lastLine, comment, [expr...], [statement...])
+
+   where staterule is the signature of the statement's staterule, or null for comment
+   statements and the top statement.  A signature is a list with an ident for each keyword
+   and a null for each expr, which unlike the staterule's name is unique in its syntax.
+   comment is the statement's comment, or null.  A statement with a comment but no
+   staterule is a comment statement.  An expr is one of
+
+       (value, lineNum, value)
+       (ident, lineNum, name)
+       (operator, lineNum, name, [expr...])
+
+   Decoding reads the encoding in place through views.  Staterules and operators are found
+   by name in the syntax the tree was parsed with, switching to a staterule's sub-syntax for
+   its sub-statements, as the parser does. */
+
+#include "pa.h"
+
+static utSym paValueSym, paOperatorSym;
+
+// Create the symbols used to tag exprs.
+static void initSyms(void)
+{
+    if(paValueSym == utSymNull) {
+        paValueSym = utSymCreate("value");
+        paOperatorSym = utSymCreate("operator");
+    }
+}
+
+// Add an expr tree to the encoding.
+static void bencodeExpr(
+    vaSink sink,
+    paExpr expr)
+{
+    paExpr subExpr;
+
+    vaBencodeStartTuple(sink);
+    switch(paExprGetType(expr)) {
+    case PA_EXPR_VALUE:
+        vaBencodeAddIdent(sink, paValueSym);
+        vaBencodeAddUint(sink, paExprGetLineNum(expr));
+        vaBencodeAddValue(sink, paExprGetValue(expr));
+        break;
+    case PA_EXPR_IDENT:
+        vaBencodeAddIdent(sink, paIdentSym);
+        vaBencodeAddUint(sink, paExprGetLineNum(expr));
+        vaBencodeAddIdent(sink, paExprGetSym(expr));
+        break;
+    case PA_EXPR_OPERATOR:
+        vaBencodeAddIdent(sink, paOperatorSym);
+        vaBencodeAddUint(sink, paExprGetLineNum(expr));
+        vaBencodeAddIdent(sink, paOperatorGetSym(paExprGetOperator(expr)));
+        vaBencodeStartList(sink);
+        paForeachExprExpr(expr, subExpr) {
+            bencodeExpr(sink, subExpr);
+        } paEndExprExpr;
+        vaBencodeEndList(sink);
+        break;
+    default:
+        utExit("Unknown expr type");
+    }
+    vaBencodeEndList(sink);
+}
+
+// Add a statement tree to the encoding being written to the sink.
+void paBencodeStatement(
+    vaSink sink,
+    paStatement statement)
+{
+    paStaterule staterule = paStatementGetStaterule(statement);
+    vaString comment = paStatementGetComment(statement);
+    paStatement subStatement;
+    paKeyword keyword;
+    paExpr expr;
+
+    initSyms();
+    vaBencodeStartTuple(sink);
+    if(staterule == paStateruleNull) {
+        vaBencodeAddNull(sink);
+    } else {
+        vaBencodeStartList(sink);
+        paForeachStateruleSignature(staterule, keyword) {
+            if(keyword == paKeywordNull) {
+                vaBencodeAddNull(sink);
+            } else {
+                vaBencodeAddIdent(sink, paKeywordGetSym(keyword));
+            }
+        } paEndStateruleSignature;
+        vaBencodeEndList(sink);
+    }
+    vaBencodeAddUint(sink, paStatementGetFirstLine(statement));
+    vaBencodeAddUint(sink, paStatementGetLastLine(statement));
+    if(comment != vaStringNull) {
+        vaBencodeAddString(sink, vaStringGetValue(comment));
+    } else {
+        vaBencodeAddNull(sink);
+    }
+    vaBencodeStartList(sink);
+    paForeachStatementExpr(statement, expr) {
+        bencodeExpr(sink, expr);
+    } paEndStatementExpr;
+    vaBencodeEndList(sink);
+    vaBencodeStartList(sink);
+    paForeachStatementStatement(statement, subStatement) {
+        paBencodeStatement(sink, subStatement);
+    } paEndStatementStatement;
+    vaBencodeEndList(sink);
+    vaBencodeEndList(sink);
+}
+
+// Encode a statement tree.  This returns a utBuffer, so use it soon.
+uchar *paStatementBencode(
+    paStatement statement,
+    uint64 *length)
+{
+    vaSink sink = vaMemorySinkCreate();
+    uint8 *encoding;
+    uchar *bytes;
+
+    paBencodeStatement(sink, statement);
+    encoding = vaSinkGetBytes(sink, length);
+    bytes = utNewBufA(uchar, *length);
+    memcpy(bytes, encoding, *length);
+    vaSinkDestroy(sink);
+    return bytes;
+}
+
+// Return the ident in the view as a sym.
+static utSym viewSym(
+    vaEncodedView view)
+{
+    if(vaEncodedViewGetType(view) != VA_IDENT) {
+        utExit("Expected an ident in encoded statement");
+    }
+    return utSymCreate((char *)vaEncodedViewGetText(view));
+}
+
+// Find the staterule with the encoded signature in the syntax.
+static paStaterule findStaterule(
+    paSyntax syntax,
+    vaEncodedView view)
+{
+    uint32 numKeywords = vaEncodedViewCountElements(view);
+    paKeyword keywords[numKeywords + 1];
+    paStaterule staterule;
+    vaEncodedView element;
+    paKeyword keyword;
+    uint32 xKeyword = 0;
+    utSym sym;
+
+    vaForeachEncodedViewElement(view, element) {
+        keyword = paKeywordNull;
+        if(vaEncodedViewGetType(element) != VA_NULL) {
+            sym = viewSym(element);
+            keyword = paSyntaxFindKeyword(syntax, sym);
+            if(keyword == paKeywordNull) {
+                utExit("Keyword %s not found in syntax %s", utSymGetName(sym),
+                    paSyntaxGetName(syntax));
+            }
+        }
+        keywords[xKeyword++] = keyword;
+    } vaEndEncodedViewElement;
+    staterule = paSyntaxFindStaterule(syntax, keywords, numKeywords);
+    if(staterule == paStateruleNull) {
+        utExit("Staterule not found in syntax %s", paSyntaxGetName(syntax));
+    }
+    return staterule;
+}
+
+// Decode an expr tree.  Values are decoded from the region if there is one, so that blobs
+// borrow their bytes from it.
+static paExpr bdecodeExpr(
+    paSyntax syntax,
+    vaRegion region,
+    vaEncodedView view)
+{
+    vaEncodedView element = vaEncodedViewGetFirst(view);
+    utSym type = viewSym(element);
+    uint32 lineNum;
+    paOperator operator;
+    vaEncodedView child;
+    paExpr expr;
+    utSym sym;
+
+    element = vaEncodedViewGetNext(element);
+    lineNum = vaEncodedViewGetUint(element);
+    element = vaEncodedViewGetNext(element);
+    if(type == paValueSym) {
+        expr = paValueExprCreate(region != NULL? vaBdecodeRegion(region, element.bytes) :
+            vaEncodedViewMaterialize(element));
+    } else if(type == paIdentSym) {
+        expr = paIdentExprCreate(viewSym(element));
+    } else if(type == paOperatorSym) {
+        sym = viewSym(element);
+        operator = paSyntaxFindOperator(syntax, sym);
+        if(operator == paOperatorNull) {
+            utExit("Operator %s not found in syntax %s", utSymGetName(sym),
+                paSyntaxGetName(syntax));
+        }
+        expr = paOperatorExprCreate(operator);
+        vaForeachEncodedViewElement(vaEncodedViewGetNext(element), child) {
+            paExprAppendExpr(expr, bdecodeExpr(syntax, region, child));
+        } vaEndEncodedViewElement;
+    } else {
+        utExit("Unknown expr type %s", utSymGetName(type));
+        return paExprNull; // Dummy return
+    }
+    paExprSetLineNum(expr, lineNum);
+    return expr;
+}
+
+// Decode a statement tree, and add it to the outer statement, if any.
+static paStatement bdecodeStatement(
+    paSyntax syntax,
+    vaRegion region,
+    paStatement outerStatement,
+    vaEncodedView view)
+{
+    vaEncodedView element = vaEncodedViewGetFirst(view);
+    vaEncodedView stateruleView = element;
+    paStaterule staterule = paStateruleNull;
+    vaString comment = vaStringNull;
+    paStatement statement;
+    vaEncodedView child;
+    paSyntax subSyntax;
+    uint32 firstLine, lastLine;
+
+    element = vaEncodedViewGetNext(element);
+    firstLine = vaEncodedViewGetUint(element);
+    element = vaEncodedViewGetNext(element);
+    lastLine = vaEncodedViewGetUint(element);
+    element = vaEncodedViewGetNext(element);
+    if(vaEncodedViewGetType(element) == VA_STRING) {
+        comment = vaStringCreate(vaEncodedViewGetText(element));
+    }
+    if(vaEncodedViewGetType(stateruleView) != VA_NULL) {
+        staterule = findStaterule(syntax, stateruleView);
+        statement = paStatementCreate(outerStatement, staterule);
+        paStatementSetComment(statement, comment);
+    } else if(comment != vaStringNull) {
+        statement = paCommentStatementCreate(outerStatement, comment);
+    } else {
+        statement = paStatementCreate(outerStatement, paStateruleNull);
+    }
+    paStatementSetFirstLine(statement, firstLine);
+    paStatementSetLastLine(statement, lastLine);
+    element = vaEncodedViewGetNext(element);
+    vaForeachEncodedViewElement(element, child) {
+        paStatementAppendExpr(statement, bdecodeExpr(syntax, region, child));
+    } vaEndEncodedViewElement;
+    subSyntax = syntax;
+    if(staterule != paStateruleNull && paStateruleGetSubSyntaxSym(staterule) != utSymNull) {
+        subSyntax = paRootFindSyntax(paTheRoot, paStateruleGetSubSyntaxSym(staterule));
+        if(subSyntax == paSyntaxNull) {
+            subSyntax = syntax;
+        }
+    }
+    vaForeachEncodedViewElement(vaEncodedViewGetNext(element), child) {
+        bdecodeStatement(subSyntax, region, statement, child);
+    } vaEndEncodedViewElement;
+    return statement;
+}
+
+// Decode a statement tree encoded by paBencodeStatement, which was parsed with the syntax.
+// Exits if the encoding names staterules or operators the syntax does not have.
+paStatement paStatementBdecode(
+    paSyntax syntax,
+    uint8 *bytes)
+{
+    initSyms();
+    return bdecodeStatement(syntax, NULL, paStatementNull, vaEncodedViewCreate(bytes));
+}
+
+// Decode a statement tree whose encoding is in a region.  Blobs in value exprs borrow their
+// bytes from the region.
+paStatement paStatementBdecodeRegion(
+    paSyntax syntax,
+    vaRegion region,
+    uint8 *bytes)
+{
+    initSyms();
+    return bdecodeStatement(syntax, region, paStatementNull, vaEncodedViewCreate(bytes));
+}
+
+// Save a statement tree to a file.  Return false if it can't be written.
+bool paSaveStatement(
+    paStatement statement,
+    char *fileName)
+{
+    FILE *file = fopen(fileName, "wb");
+    vaSink sink;
+    bool passed;
+
+    if(file == NULL) {
+        return false;
+    }
+    sink = vaFileSinkCreate(file);
+    paBencodeStatement(sink, statement);
+    passed = vaSinkFlush(sink);
+    vaSinkDestroy(sink);
+    if(fclose(file) != 0) {
+        passed = false;
+    }
+    return passed;
+}
+
+// Load a statement tree saved by paSaveStatement.  The file is mapped rather than read, and
+// blobs in it are borrowed rather than copied.  Return paStatementNull if it can't be opened.
+paStatement paLoadStatement(
+    paSyntax syntax,
+    char *fileName)
+{
+    vaRegion region = vaFileRegionCreate(fileName);
+    paStatement statement;
+    uint64 length;
+    uint8 *bytes;
+
+    if(region == NULL) {
+        return paStatementNull;
+    }
+    bytes = vaRegionGetBytes(region, &length);
+    if(length == 0) {
+        vaRegionUnref(region);
+        return paStatementNull;
+    }
+    statement = paStatementBdecodeRegion(syntax, region, bytes);
+    // Blobs that borrowed from the file hold their own references.
+    vaRegionUnref(region);
+    return statement;
+}
+
+// Hash the encoding of the statement tree, starting from the seed.  The encoding is hashed
+// as it is written, and is never held in memory.
+uint64 paStatementHash(
+    paStatement statement,
+    uint64 seed)
+{
+    vaHasher hasher;
+    vaSink sink;
+
+    vaHasherStart(&hasher, seed);
+    sink = vaHashSinkCreate(&hasher);
+    paBencodeStatement(sink, statement);
+    vaSinkFlush(sink);
+    vaSinkDestroy(sink);
+    return vaHasherFinish(&hasher);
+}
+
+// Check that a statement tree with comments and a block survives encoding and decoding.
+void paSerializeSelfTest(void)
+{
+    char *text = "// A comment statement\n"
+        "statement simpleStatement: \"statement\" statementExpr // A trailing comment\n"
+        "group {\n"
+        "    ruleExpr: nodeExpr | or[nodeExpr]\n"
+        "    merge or: expr \"|\" expr\n"
+        "}\n";
+    paStatement statement, decoded;
+    uchar *bytes;
+    uint64 length;
+
+    statement = paParseBuffer(paParseSyntax, (uchar *)text, strlen(text));
+    bytes = paStatementBencode(statement, &length);
+    decoded = paStatementBdecode(paParseSyntax, bytes);
+    if(paStatementHash(statement, 0) != paStatementHash(decoded, 0)) {
+        utExit("Decoded statement tree differs from the original");
+    }
+    paStatementDestroy(statement);
+    paStatementDestroy(decoded);
+    printf("Passed statement serialization\n");
+}
@@ -0,0 +1,435 @@
+/* Parse server.  Starting parse42 and compiling a rules file costs far more than parsing a
+   small data file, so the server keeps compiled syntaxes resident and parses requests sent
+   over a Unix-domain socket.  A syntax is reused until the modification time of its rules
+   file changes.
+
+   Requests and responses are frames: an 8-byte big-endian length followed by that many
+   bytes of bencoded value.  A request is the tuple (rulesFile, data), where rulesFile is a
+   string, and data is either a string naming the file to parse or a blob holding the text
+   itself.  The response is (true, statement), with the statement tree encoded as in
+   serialize.c, or (false, message).
+
+   Clients may keep their connection open and send many requests.  Requests are handled one
+   at a time, since the parser is single threaded.  Requests are checked before they are
+   decoded, and clients sending frames over PA_MAX_FRAME bytes are dropped.
+
+   The server serves only the local user.  Its socket is created with mode 0600, and any
+   client that can connect can make the server read any file the user can. */
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "pa.h"
+
+#define PA_MAX_CLIENTS 64
+#define PA_FRAME_HEADER 8
+#define PA_MAX_FRAME (1llu << 28) // Largest request accepted
+#define PA_MAX_DEPTH 64 // Deepest nesting of containers accepted in a request
+
+typedef struct {
+    int fd;
+    uchar *buffer; // Bytes received but not yet handled
+    uint64 size, used;
+} paClient;
+
+static paClient paClients[PA_MAX_CLIENTS];
+static uint32 paNumClients;
+static char *paServerError;
+static char *paRulesFile; // Rules file of the request being handled
+static vaValue paRequest; // The request being handled
+
+// Read a whole file into memory.  Return NULL if it cannot be read.
+static uchar *readFile(
+    char *fileName,
+    uint64 *length)
+{
+    FILE *file = fopen(fileName, "rb");
+    uchar *bytes;
+    long size;
+
+    if(file == NULL) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    bytes = utNewA(uchar, size + 1);
+    if(size < 0 || fread(bytes, 1, size, file) != (size_t)size) {
+        utFree(bytes);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+    *length = size;
+    return bytes;
+}
+
+// Find the modification time of a file in nanoseconds.  Return 0 if it does not exist.
+static uint64 findModificationTime(
+    char *fileName)
+{
+    struct stat status;
+
+    if(stat(fileName, &status) != 0) {
+        return 0;
+    }
+    return (uint64)status.st_mtim.tv_sec*1000000000llu + status.st_mtim.tv_nsec;
+}
+
+// Find the syntax for the rules file, compiling it if it is not cached or has changed.
+// Return paSyntaxNull if the rules file cannot be read.
+static paSyntax findSyntax(
+    char *rulesFile)
+{
+    utSym name = utSymCreate(rulesFile);
+    paSyntax syntax = paRootFindSyntax(paTheRoot, name);
+    uint64 mtime = findModificationTime(rulesFile);
+    uchar *rules;
+    uint64 length;
+
+    if(syntax != paSyntaxNull) {
+        if(paSyntaxGetMtime(syntax) == mtime) {
+            return syntax;
+        }
+        paSyntaxDestroy(syntax);
+    }
+    rules = readFile(rulesFile, &length);
+    if(rules == NULL) {
+        paServerError = utSprintf("Unable to read rules file %s", rulesFile);
+        return paSyntaxNull;
+    }
+    syntax = paSyntaxCreateFromBuffer(name, rules, length);
+    utFree(rules);
+    // A zero mtime marks a syntax that failed to compile.
+    paSyntaxSetMtime(syntax, mtime);
+    return syntax;
+}
+
+// Parse the data, which is a file name or the text itself.
+static paStatement parseData(
+    paSyntax syntax,
+    vaValue data)
+{
+    paStatement statement;
+    vaBlob blob;
+    uchar *bytes;
+    char *fileName;
+    uint64 length;
+
+    if(vaValueGetType(data) == VA_BLOB) {
+        blob = vaValueGetBlobVal(data);
+        return paParseBuffer(syntax, vaBlobGetValue(blob), vaBlobGetLength(blob));
+    }
+    fileName = (char *)vaStringGetValue(vaValueGetStringVal(data));
+    bytes = readFile(fileName, &length);
+    if(bytes == NULL) {
+        paServerError = utSprintf("Unable to read data file %s", fileName);
+        return paStatementNull;
+    }
+    statement = paParseBuffer(syntax, bytes, length);
+    utFree(bytes);
+    return statement;
+}
+
+// Clean up after an error, including a syntax that failed to compile.
+static void abortRequest(
+    char *rulesFile)
+{
+    paSyntax syntax = paRootFindSyntax(paTheRoot, utSymCreate(rulesFile));
+
+    paParseAbort();
+    if(syntax != paSyntaxNull && paSyntaxGetMtime(syntax) == 0) {
+        paSyntaxDestroy(syntax);
+    }
+}
+
+// Check that the request is a (rulesFile, data) tuple.
+static bool requestValid(
+    vaValue request)
+{
+    vaList list;
+    vaType dataType;
+
+    if(vaValueGetType(request) != VA_TUPLE) {
+        return false;
+    }
+    list = vaValueGetTupleVal(request);
+    if(vaListGetUsedValue(list) != 2 ||
+            vaValueGetType(vaListGetiValue(list, 0)) != VA_STRING) {
+        return false;
+    }
+    dataType = vaValueGetType(vaListGetiValue(list, 1));
+    return dataType == VA_STRING || dataType == VA_BLOB;
+}
+
+// Parse the request, and encode the response in the memory sink.  Return the response, which
+// belongs to the sink.
+static uchar *handleRequest(
+    vaSink sink,
+    uchar *bytes,
+    uint64 frameLength,
+    uint64 *length)
+{
+    vaList list;
+    paSyntax syntax;
+    paStatement statement = paStatementNull;
+
+    paServerError = "Syntax error";
+    paRulesFile = NULL;
+    paRequest = vaValueNull;
+    if(utSetjmp()) {
+        if(paRulesFile != NULL) {
+            abortRequest(paRulesFile);
+        }
+        statement = paStatementNull;
+    } else {
+        if(vaEncodingValid(bytes, frameLength, PA_MAX_DEPTH)) {
+            paRequest = vaBdecode(bytes);
+        }
+        if(paRequest != vaValueNull && requestValid(paRequest)) {
+            list = vaValueGetTupleVal(paRequest);
+            paRulesFile = (char *)vaStringGetValue(
+                vaValueGetStringVal(vaListGetiValue(list, 0)));
+            syntax = findSyntax(paRulesFile);
+            if(syntax != paSyntaxNull) {
+                statement = parseData(syntax, vaListGetiValue(list, 1));
+            }
+        } else {
+            paServerError = "Expected (rulesFile, data) request";
+        }
+        utUnsetjmp();
+    }
+    // The rules file name points into the request, so it goes last.
+    if(paRequest != vaValueNull) {
+        vaValueDestroyUnshared(paRequest);
+        paRequest = vaValueNull;
+    }
+    paRulesFile = NULL;
+    vaSinkClear(sink);
+    vaBencodeStartTuple(sink);
+    vaBencodeAddBool(sink, statement != paStatementNull);
+    if(statement != paStatementNull) {
+        paBencodeStatement(sink, statement);
+        paStatementDestroy(statement);
+    } else {
+        vaBencodeAddString(sink, (uchar *)paServerError);
+    }
+    vaBencodeEndList(sink);
+    return vaSinkGetBytes(sink, length);
+}
+
+// Write all the bytes, unless the client has gone away.
+static bool writeBytes(
+    int fd,
+    uchar *bytes,
+    uint64 length)
+{
+    ssize_t written;
+
+    while(length != 0) {
+        written = send(fd, bytes, length, MSG_NOSIGNAL);
+        if(written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        bytes += written;
+        length -= written;
+    }
+    return true;
+}
+
+// Encode the frame length, most significant byte first.
+static void encodeFrameLength(
+    uchar *header,
+    uint64 length)
+{
+    int32 xByte;
+
+    for(xByte = PA_FRAME_HEADER - 1; xByte >= 0; xByte--) {
+        header[xByte] = (uchar)length;
+        length >>= 8;
+    }
+}
+
+// Decode the frame length.
+static uint64 decodeFrameLength(
+    uchar *header)
+{
+    uint64 length = 0;
+    uint32 xByte;
+
+    for(xByte = 0; xByte < PA_FRAME_HEADER; xByte++) {
+        length = (length << 8) | header[xByte];
+    }
+    return length;
+}
+
+// Close the client's connection.
+static void closeClient(
+    uint32 xClient)
+{
+    paClient *client = paClients + xClient;
+
+    close(client->fd);
+    utFree(client->buffer);
+    *client = paClients[--paNumClients];
+}
+
+// Handle each complete request the client has sent.  Return false if the client should be
+// dropped.
+static bool handleFrames(
+    paClient *client)
+{
+    uchar header[PA_FRAME_HEADER];
+    uchar *response;
+    uint64 frameLength, responseLength, handled = 0;
+    vaSink sink = vaMemorySinkCreate();
+    bool connected = true;
+
+    while(connected && client->used - handled >= PA_FRAME_HEADER) {
+        frameLength = decodeFrameLength(client->buffer + handled);
+        if(frameLength > PA_MAX_FRAME) {
+            connected = false;
+            break;
+        }
+        if(client->used - handled - PA_FRAME_HEADER < frameLength) {
+            break;
+        }
+        // Zero-terminate the request, so a truncated string can't run off the end.
+        client->buffer[handled + PA_FRAME_HEADER + frameLength] = '\0';
+        response = handleRequest(sink, client->buffer + handled + PA_FRAME_HEADER,
+            frameLength, &responseLength);
+        encodeFrameLength(header, responseLength);
+        connected = writeBytes(client->fd, header, PA_FRAME_HEADER) &&
+            writeBytes(client->fd, response, responseLength);
+        handled += PA_FRAME_HEADER + frameLength;
+    }
+    vaSinkDestroy(sink);
+    if(!connected) {
+        return false;
+    }
+    client->used -= handled;
+    memmove(client->buffer, client->buffer + handled, client->used);
+    if(client->used >= PA_FRAME_HEADER) {
+        // Make room for the whole frame, and the zero after it.  The loop above has checked
+        // that the frame is no longer than PA_MAX_FRAME.
+        frameLength = PA_FRAME_HEADER + decodeFrameLength(client->buffer) + 1;
+        if(frameLength > client->size) {
+            client->size = frameLength;
+            utResizeArray(client->buffer, client->size);
+        }
+    }
+    return true;
+}
+
+// Read what the client has sent.  Return false if the client should be dropped.
+static bool readClient(
+    paClient *client)
+{
+    ssize_t bytesRead;
+
+    // Keep a byte spare for the zero after a request.
+    if(client->used + 1 == client->size) {
+        client->size <<= 1;
+        utResizeArray(client->buffer, client->size);
+    }
+    bytesRead = read(client->fd, client->buffer + client->used,
+        client->size - client->used - 1);
+    if(bytesRead < 0 && errno == EINTR) {
+        return true;
+    }
+    if(bytesRead <= 0) {
+        return false;
+    }
+    client->used += bytesRead;
+    return handleFrames(client);
+}
+
+// Accept a new connection.
+static void acceptClient(
+    int listenFd)
+{
+    int fd = accept(listenFd, NULL, NULL);
+    paClient *client;
+
+    if(fd < 0) {
+        return;
+    }
+    if(paNumClients == PA_MAX_CLIENTS) {
+        close(fd);
+        return;
+    }
+    client = paClients + paNumClients++;
+    client->fd = fd;
+    client->size = 4096;
+    client->used = 0;
+    client->buffer = utNewA(uchar, client->size);
+}
+
+// Create the listening socket.
+static int openSocket(
+    char *socketPath)
+{
+    struct sockaddr_un address;
+    mode_t oldMask;
+    int fd;
+
+    if(strlen(socketPath) >= sizeof(address.sun_path)) {
+        utError("Socket path %s is too long", socketPath);
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socketPath);
+    unlink(socketPath);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    // Create the socket file with mode 0600, so other users cannot connect.
+    oldMask = umask(0077);
+    if(fd >= 0 && bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    umask(oldMask);
+    if(fd < 0 || listen(fd, PA_MAX_CLIENTS) != 0) {
+        utError("Unable to listen on %s: %s", socketPath, strerror(errno));
+    }
+    return fd;
+}
+
+// Serve parse requests on the Unix-domain socket.  This does not return.
+void paServe(
+    char *socketPath)
+{
+    struct pollfd fds[PA_MAX_CLIENTS + 1];
+    int listenFd = openSocket(socketPath);
+    uint32 xClient;
+
+    utLogMessage("Serving parse requests on %s", socketPath);
+    while(true) {
+        fds[0].fd = listenFd;
+        fds[0].events = POLLIN;
+        for(xClient = 0; xClient < paNumClients; xClient++) {
+            fds[xClient + 1].fd = paClients[xClient].fd;
+            fds[xClient + 1].events = POLLIN;
+        }
+        if(poll(fds, paNumClients + 1, -1) < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            utError("poll failed: %s", strerror(errno));
+        }
+        // Go backwards, since closing a client moves the last one into its slot.
+        for(xClient = paNumClients; xClient-- != 0;) {
+            if(fds[xClient + 1].revents != 0 && !readClient(paClients + xClient)) {
+                closeClient(xClient);
+            }
+        }
+        if(fds[0].revents & POLLIN) {
+            acceptClient(listenFd);
+        }
+    }
+}
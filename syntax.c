@@ -758,7 +758,7 @@ void paSetOperatorPrecedence(
     syntaxBuildNodelists(syntax);
 }
 
-// Update syntax rules from the syntax statement.
+// Update syntax rules from the syntax statement, and fold it into the syntax's fingerprint.
 void paProcessSyntaxStatement(
     paSyntax targetSyntax,
     paStatement statement)
@@ -772,6 +772,8 @@ void paProcessSyntaxStatement(
     } paEndStatementStatement;
     paCheckNoderules(paTargetSyntax);
     paSetOperatorPrecedence(paTargetSyntax);
+    paSyntaxSetFingerprint(targetSyntax, paStatementHash(statement,
+        paSyntaxGetFingerprint(targetSyntax)));
 }
 
 // Print a node expr.
@@ -1,46 +1,46 @@
 /* Encode/decode a value to a binary sequence of bytes.
 
-This file implements the binary encoding of L42 values. */
+This file implements the binary encoding of L42 values.  Version 2 of the encoding gives
+strings and idents a length, and containers their byte size and element count, so values
+can be skipped without reading them.  Both versions are decoded. */
 
 #include <ctype.h>
+#include <stdlib.h>
 #include "value.h"
 
-// These structures help convert byte order to network byte order, which is most significant
-// byte first.
-union vaOrder32Union {
-    uint32 intVal;
-    uint8 byteArray[4];
-};
-
-static union vaOrder32Union vaOrder32;
-static union vaOrder64Union vaOrder64;
-
-union vaOrder64Union {
-    uint64 intVal;
-    uint8 byteArray[8];
-};
+// The state of one encoding, so encodings to different sinks can run at once.
+typedef struct {
+    vaSink sink;
+    bool version2;
+    bool canonical; // Sort dictionary entries, and write zeros without a sign
+    uint64 *containerSizes; // Element sizes of version 2 containers, in the order encoded
+    uint32 containerSizesSize, numContainerSizes, containerSizePos;
+} vaEncoder;
+
+// A dictionary key encoded in a scratch buffer, for sorting entries.
+typedef struct {
+    uint8 *bytes;
+    uint64 offset, length;
+    uint32 xEntry;
+} vaEncodedKey;
 
-static uchar *vaEncodedValue;
-static uint64 vaValueSize, vaValuePos;
-static uchar *vaStringBuffer;
-static uint32 vaStringBufferSize, vaStringBufferPos;
+// These hold the results of the convenience functions that return a shared buffer.  Only one
+// thread should call those, and others should pass their own sink.
+static vaSink vaBencodeSink; // Holds the bytes returned by vaBencode and vaBencode2
+static vaSink vaTextSink; // Holds the text returned by vaMungeString and vaEscapeIdent
 
 // Initialize the bencode module.
 void vaBencodeStart(void)
 {
-    vaValueSize = 42;
-    vaEncodedValue = utNewA(uint8, vaValueSize);
-    vaOrder32.intVal = 0x00010203u;
-    vaOrder64.intVal = 0x0001020304050607llu;
-    vaStringBufferSize = 42;
-    vaStringBuffer = utNewA(uchar, vaStringBufferSize);
+    vaBencodeSink = vaMemorySinkCreate();
+    vaTextSink = vaMemorySinkCreate();
 }
 
 // Free memory used by the bencode module.
 void vaBencodeStop(void)
 {
-    utFree(vaEncodedValue);
-    utFree(vaStringBuffer);
+    vaSinkDestroy(vaBencodeSink);
+    vaSinkDestroy(vaTextSink);
 }
 
 // Decode an encoded unsigned integer value.
@@ -57,138 +57,103 @@ uint64 vaDecodeUint(
     return value;
 }
 
-// Decode a float value.
+// Find the length of an encoded unsigned integer, including its type byte.
+static inline uint64 findUintLength(
+    uint8 *bytes)
+{
+    return (*bytes & 0x7) + 2;
+}
+
+// Find the start of the elements of an encoded tuple, list or dictionary.  For version 2
+// containers, also return the end of the elements and the element count.  Otherwise, end is
+// set to NULL, and the elements are terminated by an 'E'.
+uint8 *vaFindEncodedElements(
+    uint8 *bytes,
+    uint8 **end,
+    uint64 *count)
+{
+    uint8 *sizeBytes, *countBytes;
+
+    if(*bytes == 't' || *bytes == 'l' || *bytes == 'd') {
+        *end = NULL;
+        return bytes + 1;
+    }
+    sizeBytes = bytes + 1;
+    countBytes = sizeBytes + findUintLength(sizeBytes);
+    bytes = countBytes + findUintLength(countBytes);
+    *end = bytes + vaDecodeUint(sizeBytes);
+    *count = vaDecodeUint(countBytes);
+    return bytes;
+}
+
+// Return the text of an encoded string or ident.
+uchar *vaFindEncodedText(
+    uint8 *bytes)
+{
+    if(*bytes == 's' || *bytes == 'i') {
+        return bytes + 1;
+    }
+    return bytes + 1 + findUintLength(bytes + 1);
+}
+
+// Decode a float value, stored most significant byte first.
 float vaDecodeFloat(
     uint8 *bytes)
 {
+    uint32 bits = 0;
     float value;
-    uint8 *p = (uint8 *)(void *)&value;
     int i;
 
     for(i = 0; i < 4; i++) {
-        p[vaOrder32.byteArray[i]] = *bytes++;
+        bits = (bits << 8) | *bytes++;
     }
+    memcpy(&value, &bits, sizeof(float));
     return value;
 }
 
-// Decode a double value.
+// Decode a double value, stored most significant byte first.
 double vaDecodeDouble(
     uint8 *bytes)
 {
+    uint64 bits = 0;
     double value;
-    uint8 *p = (uint8 *)(void *)&value;
     int i;
 
     for(i = 0; i < 8; i++) {
-        p[vaOrder64.byteArray[i]] = *bytes++;
+        bits = (bits << 8) | *bytes++;
     }
+    memcpy(&value, &bits, sizeof(double));
     return value;
 }
 
-// Add a character to the string buffer.
-static inline void addToStringBuffer(
-    uchar c)
+// Return the text in the text sink, zero-terminated.  It is overwritten on the next call.
+static uchar *finishText(void)
 {
-    if(vaStringBufferPos == vaStringBufferSize) {
-        vaStringBufferSize <<= 1;
-        utResizeArray(vaStringBuffer, vaStringBufferSize);
-    }
-    vaStringBuffer[vaStringBufferPos++] = c;
+    uint64 length;
+
+    vaSinkAddByte(vaTextSink, '\0');
+    return vaSinkGetBytes(vaTextSink, &length);
 }
 
-// Insert backslashes before quotes, and covert tabs to \t, newlines to \n, and
-// returns to \r.  Other control characters are encoded as \%d.  This returns a pointer to a
-// static buffer, which is overwritten on the next call.
+// Quote the string, with backslashes before quotes, and tabs, newlines and returns converted
+// to \t, \n and \r.  Other control characters are encoded as \%d.  This returns a pointer to
+// a static buffer, which is overwritten on the next call.
 uchar *vaMungeString(
     uint8 *bytes)
 {
-    uchar c = *bytes++;
-    uint8 extra;
-
-    vaStringBufferPos = 0;
-    addToStringBuffer('"');
-    while(c != '\0') {
-        if(c < ' ' || c == '"' || c == '\\') {
-            addToStringBuffer('\\');
-            if(c == '"') {
-                addToStringBuffer('"');
-            } else if(c == '\\') {
-                addToStringBuffer('\\');
-            } else if(c == '\t') {
-                addToStringBuffer('t');
-            } else if(c == '\n') {
-                addToStringBuffer('n');
-            } else if(c == '\r') {
-                addToStringBuffer('r');
-            } else {
-                if(c >= 10) {
-                    addToStringBuffer(c/10 + '0');
-                    c -= (c/10)*10;
-                }
-                addToStringBuffer(c + '0');
-            }
-        } else {
-            addToStringBuffer(c);
-            extra = utf8FindLength(c) - 1;
-            while(extra--) {
-                c = *bytes++;
-                addToStringBuffer(c);
-            }
-        }
-        c = *bytes++;
-    }
-    addToStringBuffer('"');
-    addToStringBuffer('\0');
-    return vaStringBuffer;
+    vaSinkClear(vaTextSink);
+    vaWriteString(vaTextSink, bytes);
+    return finishText();
 }
 
-// Escape anything that's not alnum or _.  Allow non-ASCII characers without escapes.
+// Escape anything that's not alnum or _.  Allow non-ASCII characers without escapes.  This
+// returns a pointer to a static buffer, which is overwritten on the next call.
 uchar *vaEscapeIdent(
     uint8 *bytes)
 {
-    uchar c;
-    uint8 extra;
-
-    if(!strcmp((char *)bytes, "false")) {
-        return (uchar *)"\\false";
-    } else if(!strcmp((char *)bytes, "true")) {
-        return (uchar *)"\\true";
-    } else if(!strcmp((char *)bytes, "null")) {
-        return (uchar *)"\\null";
-    }
-    c = *bytes++;
-    vaStringBufferPos = 0;
-    while(c != '\0') {
-        if(c < ' ') {
-            addToStringBuffer('\\');
-            if(c == '\t') {
-                addToStringBuffer('t');
-            } else if(c == '\n') {
-                addToStringBuffer('n');
-            } else if(c == '\r') {
-                addToStringBuffer('r');
-            } else {
-                if(c >= 10) {
-                    addToStringBuffer(c/10 + '0');
-                    c -= (c/10)*10;
-                }
-                addToStringBuffer(c + '0');
-            }
-        } else {
-            if(!isalnum(c) && !(c & 0x80)) {
-                addToStringBuffer('\\');
-            }
-            addToStringBuffer(c);
-            extra = utf8FindLength(c) - 1;
-            while(extra--) {
-                c = *bytes++;
-                addToStringBuffer(c);
-            }
-        }
-        c = *bytes++;
-    }
-    addToStringBuffer('\0');
-    return vaStringBuffer;
+    vaSinkClear(vaTextSink);
+    vaWriteIdent(vaTextSink, bytes);
+    return finishText();
 }
 
 // Find the length of an encoded value, including the type byte.
@@ -196,7 +161,8 @@ uint64 vaFindEncodedValueLength(
     uint8 *bytes)
 {
     uint8 type = *bytes;
-    uint64 length, totalLength;
+    uint64 length, totalLength, count;
+    uint8 *end;
 
     if(type & 0x80) {
         // Must be a length coded value.
@@ -211,6 +177,9 @@ uint64 vaFindEncodedValueLength(
     case 'f': return 5;
     case 'g': return 9;
     case 's': case 'i': return 2 + strlen((char *)(bytes + 1));
+    case 'S': case 'I': return 2 + findUintLength(bytes + 1) + vaDecodeUint(bytes + 1);
+    case 'P': case 'L': case 'D':
+        return vaFindEncodedElements(bytes, &end, &count) - bytes + vaDecodeUint(bytes + 1);
     case 't': case 'l': case 'd':
         totalLength = 2;
         type = *++bytes;
@@ -227,225 +196,322 @@ uint64 vaFindEncodedValueLength(
     return 0; // Dummy return
 }
 
-// Just print a tupple.
-static void printTupple(
+// Print the encoded value as text.
+void vaPrintEncodedValue(
     uint8 *bytes)
 {
-    uint8 type = *++bytes;
-    bool firstTime = true;
+    vaSink sink = vaFileSinkCreate(stdout);
 
-    printf("(");
-    while(type != 'E') {
-        if(!firstTime) {
-            printf(", ");
-        }
-        firstTime = false;
-        vaPrintEncodedValue(bytes);
-        bytes += vaFindEncodedValueLength(bytes);
-    }
-    printf(")");
+    vaWriteEncodedValue(sink, bytes);
+    vaSinkFlush(sink);
+    vaSinkDestroy(sink);
 }
 
-// Just print a list.
-static void printList(
-    uint8 *bytes)
+static vaValue decodeValue(uint8 **bytesPtr, vaRegion region);
+
+// Decode the elements of a tuple or list, leaving bytesPtr after the container.
+static vaList decodeList(
+    uint8 **bytesPtr,
+    vaRegion region)
 {
-    uint8 type = *++bytes;
-    bool firstTime = true;
+    vaList list = vaListAlloc();
+    uint64 count = 0;
+    uint8 *end;
+    uint8 *bytes = vaFindEncodedElements(*bytesPtr, &end, &count);
 
-    printf("[");
-    while(type != 'E') {
-        if(!firstTime) {
-            printf(", ");
-        }
-        firstTime = false;
-        vaPrintEncodedValue(bytes);
-        bytes += vaFindEncodedValueLength(bytes);
+    if(count != 0) {
+        // Version 2 containers can be allocated up front.
+        vaListResizeValues(list, count);
+    }
+    while(end != NULL? bytes < end : *bytes != 'E') {
+        vaListAppendValue(list, decodeValue(&bytes, region));
     }
-    printf("]");
+    *bytesPtr = end != NULL? end : bytes + 1;
+    return list;
 }
 
-// Just print a dictionary.
-static void printDictionary(
-    uint8 *bytes)
+// Decode the entries of a dictionary, leaving bytesPtr after it.
+static vaDictionary decodeDictionary(
+    uint8 **bytesPtr,
+    vaRegion region)
 {
-    uint8 type = *++bytes;
-    bool firstTime = true;
+    vaDictionary dictionary = vaDictionaryCreate();
+    uint64 count = 0;
+    uint8 *end;
+    uint8 *bytes = vaFindEncodedElements(*bytesPtr, &end, &count);
+    vaValue key;
 
-    printf("<|");
-    while(type != 'E') {
-        if(!firstTime) {
-            printf(", ");
+    if(count != 0) {
+        vaDictionaryReserve(dictionary, count);
+    }
+    while(end != NULL? bytes < end : *bytes != 'E') {
+        key = decodeValue(&bytes, region);
+        if(end != NULL? bytes >= end : *bytes == 'E') {
+            utExit("Dictionary has odd number of values");
         }
-        firstTime = false;
-        vaPrintEncodedValue(bytes);
-        bytes += vaFindEncodedValueLength(bytes);
-        printf(":");
-        vaPrintEncodedValue(bytes);
-        bytes += vaFindEncodedValueLength(bytes);
+        vaDictionaryInsertValue(dictionary, key, decodeValue(&bytes, region));
     }
-    printf("|>");
+    *bytesPtr = end != NULL? end : bytes + 1;
+    return dictionary;
 }
 
-// Print raw bytes in hex.
-static void printBlob(
-    uint8 *bytes)
+// Decode a blob, leaving bytesPtr after it.  If the encoding is in a region, the blob borrows
+// its bytes from it.
+static vaBlob decodeBlob(
+    uint8 **bytesPtr,
+    vaRegion region)
 {
+    uint8 *bytes = *bytesPtr;
     uint64 length = vaDecodeUint(bytes);
-    uint8 value;
 
+    // Skip the length integer
     bytes += (*bytes & 0x7) + 2;
-    printf("0b");
-    while(length--) {
-        value = *bytes++;
-        printf("%c%c", toHex(value >> 4), toHex(value & 0xf));
+    *bytesPtr = bytes + length;
+    if(region != NULL) {
+        return vaBlobCreateBorrowed(region, bytes, length);
     }
+    return vaBlobCreate(length, bytes);
 }
 
-// Just print the encoded value as ASCII
-void vaPrintEncodedValue(
-    uint8 *bytes)
+// Decode a string or ident's text, leaving bytesPtr after it.
+static uchar *decodeText(
+    uint8 **bytesPtr)
+{
+    uint8 *bytes = *bytesPtr;
+    uchar *text;
+
+    if(*bytes == 's' || *bytes == 'i') {
+        text = bytes + 1;
+        *bytesPtr = text + strlen((char *)text) + 1;
+    } else {
+        text = bytes + 1 + findUintLength(bytes + 1);
+        *bytesPtr = text + vaDecodeUint(bytes + 1) + 1;
+    }
+    return text;
+}
+
+// Decode the value, leaving bytesPtr after it.  Every byte is read once.
+static vaValue decodeValue(
+    uint8 **bytesPtr,
+    vaRegion region)
 {
+    uint8 *bytes = *bytesPtr;
     uint8 type = *bytes;
 
     if(type & 0x80) {
         // Must be an integer coded value.
-        switch(type >> 3) {
-        case 0: printf("%llu", vaDecodeUint(bytes)); break;
-        case 1: printf("-%llu", vaDecodeUint(bytes)); break;
-        case 2: printf("0p%llx", vaDecodeUint(bytes)); break;
-        case 3: printBlob(bytes);
+        if(((type >> 3) & 0xf) == 3) {
+            return vaBlobValueCreate(decodeBlob(bytesPtr, region));
+        }
+        *bytesPtr = bytes + (type & 0x7) + 2;
+        switch((type >> 3) & 0xf) {
+        case 0: return vaPosIntValueCreate(vaDecodeUint(bytes));
+        case 1: return vaNegIntValueCreate(vaDecodeUint(bytes));
+        case 2: return vaObjectValueCreate(vaDecodeUint(bytes));
         default:
             utExit("Invalide encoded value");
         }
-        return;
     }
     switch(type) {
-    case 'T': printf("true"); break;
-    case 'F': printf("false"); break;
-    case '0': printf("null"); break;
-    case 'f': printf("%gf", vaDecodeFloat(bytes + 1)); break;
-    case 'g': printf("%g", vaDecodeDouble(bytes + 1)); break;
-    case 's': printf("\"%s\"", vaMungeString(bytes + 1)); break;
-    case 'i': printf("%s", vaEscapeIdent(bytes + 1)); break;
-    case 't': printTupple(bytes); break;
-    case 'l': printList(bytes); break;
-    case 'd': printDictionary(bytes); break;
+    case 'T': *bytesPtr = bytes + 1; return vaBoolValueCreate(true);
+    case 'F': *bytesPtr = bytes + 1; return vaBoolValueCreate(false);
+    case '0': *bytesPtr = bytes + 1; return vaNullValueCreate();
+    case 'f': *bytesPtr = bytes + 5; return vaFloatValueCreate(vaDecodeFloat(bytes + 1));
+    case 'g': *bytesPtr = bytes + 9; return vaDoubleValueCreate(vaDecodeDouble(bytes + 1));
+    case 's': case 'S': return vaStringValueCreate(vaStringCreate(decodeText(bytesPtr)));
+    case 'i': case 'I': return vaIdentValueCreate(utSymCreate((char *)decodeText(bytesPtr)));
+    case 't': case 'P': return vaTupleValueCreate(decodeList(bytesPtr, region));
+    case 'l': case 'L': return vaListValueCreate(decodeList(bytesPtr, region));
+    case 'd': case 'D': return vaDictionaryValueCreate(decodeDictionary(bytesPtr, region));
     default:
         utExit("Invalid encoded value");
     }
+    return vaValueNull; // Dummy return
 }
 
-// Decode a list of values as a vaList
-vaList decodeList(
-    uint8 *bytes)
+// Convert a binary encoded value to a vaValue, and set length to the number of bytes read.
+vaValue vaBdecodeLength(
+    uchar *bytes,
+    uint64 *length)
 {
-    vaList list = vaListAlloc();
-    vaValue value;
+    uint8 *end = bytes;
+    vaValue value = decodeValue(&end, NULL);
 
-    while(*bytes != 'E') {
-        value = vaBdecode(bytes);
-        vaListAppendValue(list, value);
-        bytes += vaFindEncodedValueLength(bytes);
-    }
-    return list;
+    *length = end - bytes;
+    return value;
 }
 
-// Create a dictionary from a list of alternating keys and values.
-static vaDictionary createDictionaryFromList(
-    vaList list)
+// Convert a binary encoded value to a vaValue
+vaValue vaBdecode(
+    uchar *bytes)
 {
-    vaDictionary dictionary = vaDictionaryCreate();
-    vaValue key, value;
-    uint32 numValues = vaListGetUsedValue(list);
-    uint32 xValue;
-
-    if(numValues & 1) {
-        utExit("Dictionary has odd number of values");
-    }
-    for(xValue = 0; xValue < numValues; xValue += 2) {
-        key = vaListGetiValue(list, xValue);
-        value = vaListGetiValue(list, xValue + 1);
-        vaDictionaryInsertValue(dictionary, key, value);
-    }
-    return dictionary;
+    return decodeValue(&bytes, NULL);
 }
 
-// Decode a blob.
-static vaBlob decodeBlob(
-    uchar *bytes)
+// Convert a binary encoded value in a region to a vaValue.  Blobs borrow their bytes from
+// the region rather than copying them, so large payloads can be decoded and encoded again
+// without copies.
+vaValue vaBdecodeRegion(
+    vaRegion region,
+    uint8 *bytes)
 {
-    uint64 length = vaDecodeUint(bytes);
-
-    // Skip the length integer
-    bytes += (*bytes & 0x7) + 2;
-    return vaBlobCreate(length, bytes);
+    return decodeValue(&bytes, region);
 }
 
-// Just print the hex vesion of the message recieved.
-static void printMessage(
-    uint8 *bytes)
+// Check an encoded unsigned integer that gives a length or count, and leave bytesPtr after
+// it.
+static bool checkUint(
+    uint8 **bytesPtr,
+    uint8 *end,
+    uint64 *value)
 {
-    uint64 length = vaFindEncodedValueLength(bytes);
-    uint8 value;
-    
-    printf("Decoding %llu byte message: ", length);
-    while(length--) {
-        value = *bytes++;
-        printf("%c%c", toHex(value >> 4), toHex(value & 0xf));
+    uint8 *bytes = *bytesPtr;
+
+    if(bytes >= end || (*bytes & 0xf8) != 0x80 ||
+            (uint64)(end - bytes) < (uint64)(*bytes & 0x7) + 2) {
+        return false;
     }
-    printf("\n");
+    *value = vaDecodeUint(bytes);
+    *bytesPtr = bytes + (*bytes & 0x7) + 2;
+    return true;
 }
 
-// Convert a binary encoded value to a vaValue
-vaValue vaBdecode(
-    uchar *bytes)
+// Check the encoded value, and leave bytesPtr after it.  Nothing may lie past end, and
+// containers may be nested no deeper than depth.
+static bool checkValue(
+    uint8 **bytesPtr,
+    uint8 *end,
+    uint32 depth)
 {
-    uint8 type = *bytes;
+    uint8 *bytes = *bytesPtr;
+    uint8 *elementsEnd;
+    uint64 length, count, numValues = 0;
+    uint8 type;
 
-    printMessage(bytes);
+    if(bytes >= end) {
+        return false;
+    }
+    type = *bytes;
     if(type & 0x80) {
-        // Must be an integer coded value.
-        switch((type >> 3) & 0xf) {
-        case 0: return vaPosIntValueCreate(vaDecodeUint(bytes));
-        case 1: return vaNegIntValueCreate(vaDecodeUint(bytes));
-        case 2: return vaObjectValueCreate(vaDecodeUint(bytes));
-        case 3: return vaBlobValueCreate(decodeBlob(bytes));
-        default:
-            utExit("Invalide encoded value");
+        length = (type & 0x7) + 2;
+        if(type >= 0xa0 || (uint64)(end - bytes) < length) {
+            return false;
+        }
+        if(type >= 0x98) {
+            // Blobs are followed by their bytes.
+            if(vaDecodeUint(bytes) > (uint64)(end - bytes) - length) {
+                return false;
+            }
+            length += vaDecodeUint(bytes);
         }
+        *bytesPtr = bytes + length;
+        return true;
     }
     switch(type) {
-    case 'T': return vaBoolValueCreate(true);
-    case 'F': return vaBoolValueCreate(false);
-    case '0': return vaNullValueCreate();
-    case 'f': return vaFloatValueCreate(vaDecodeFloat(bytes + 1));
-    case 'g': return vaDoubleValueCreate(vaDecodeDouble(bytes + 1));
-    case 's': return vaStringValueCreate(vaStringCreate(bytes + 1));
-    case 'i': return vaIdentValueCreate(utSymCreate((char *)(bytes + 1)));
-    case 't': return vaTupleValueCreate(decodeList(bytes + 1));
-    case 'l': return vaListValueCreate(decodeList(bytes + 1));
-    case 'd': return vaDictionaryValueCreate(createDictionaryFromList(decodeList(bytes + 1)));
+    case 'T': case 'F': case '0': length = 1; break;
+    case 'f': length = 5; break;
+    case 'g': length = 9; break;
+    case 's': case 'i':
+        elementsEnd = (uint8 *)memchr(bytes + 1, '\0', end - bytes - 1);
+        if(elementsEnd == NULL) {
+            return false;
+        }
+        *bytesPtr = elementsEnd + 1;
+        return true;
+    case 'S': case 'I':
+        bytes++;
+        if(!checkUint(&bytes, end, &length) || length >= (uint64)(end - bytes) ||
+                bytes[length] != '\0') {
+            return false;
+        }
+        *bytesPtr = bytes + length + 1;
+        return true;
+    case 't': case 'l': case 'd':
+        if(depth == 0) {
+            return false;
+        }
+        bytes++;
+        while(bytes < end && *bytes != 'E') {
+            if(!checkValue(&bytes, end, depth - 1)) {
+                return false;
+            }
+            numValues++;
+        }
+        if(bytes == end || (type == 'd' && (numValues & 1))) {
+            return false;
+        }
+        *bytesPtr = bytes + 1;
+        return true;
+    case 'P': case 'L': case 'D':
+        if(depth == 0) {
+            return false;
+        }
+        bytes++;
+        if(!checkUint(&bytes, end, &length) || !checkUint(&bytes, end, &count) ||
+                length > (uint64)(end - bytes)) {
+            return false;
+        }
+        elementsEnd = bytes + length;
+        while(bytes < elementsEnd) {
+            if(!checkValue(&bytes, elementsEnd, depth - 1)) {
+                return false;
+            }
+            numValues++;
+        }
+        if(type == 'D') {
+            if(numValues & 1) {
+                return false;
+            }
+            numValues >>= 1;
+        }
+        // The decoder sizes containers by their count, so it must be right.
+        if(numValues != count) {
+            return false;
+        }
+        *bytesPtr = elementsEnd;
+        return true;
     default:
-        utExit("Invalid encoded value");
+        return false;
     }
-    return vaValueNull; // Dummy return
+    if((uint64)(end - bytes) < length) {
+        return false;
+    }
+    *bytesPtr = bytes + length;
+    return true;
+}
+
+// Return true if the bytes hold exactly one well formed encoded value, with containers nested
+// no deeper than maxDepth.  The decoders trust their input, so check bytes from untrusted
+// sources first.
+bool vaEncodingValid(
+    uint8 *bytes,
+    uint64 length,
+    uint32 maxDepth)
+{
+    uint8 *end = bytes + length;
+
+    return checkValue(&bytes, end, maxDepth) && bytes == end;
 }
 
-// Add a byte to the encoded value buffer.
+// Return an encoder that writes version 1 of the encoding to the sink.
+static inline vaEncoder createEncoder(
+    vaSink sink)
+{
+    vaEncoder encoder = {sink, false, false, NULL, 0, 0, 0};
+
+    return encoder;
+}
+
+// Add a byte to the encoding.
 static inline void addByte(
+    vaEncoder *encoder,
     uint8 value)
 {
-    if(vaValuePos == vaValueSize) {
-        vaValueSize <<= 1;
-        utResizeArray(vaEncodedValue, vaValueSize);
-    }
-    vaEncodedValue[vaValuePos++] = value;
-    printf("Adding %x\n", value);
+    vaSinkAddByte(encoder->sink, value);
 }
 
 // Forward declaration for recursion.
-static void bencode(vaValue value);
+static void bencode(vaEncoder *encoder, vaValue value);
 
 // Count the number of bytes needed to represent the unsigned integer.
 static inline uint8 countUintBytes(
@@ -477,156 +543,498 @@ static inline uint8 countIntBytes(
 
 // Encode an integer.
 static void encodeUint(
+    vaEncoder *encoder,
     uint8 prefix,
     uint64 value)
 {
     uint8 numBytes = countUintBytes(value);
     uint8 highByte;
 
-    addByte(0x80 | (prefix << 3) | (numBytes - 1));
+    addByte(encoder, 0x80 | (prefix << 3) | (numBytes - 1));
     while(numBytes--) {
         highByte = value >> (numBytes << 3);
-        addByte(highByte);
+        addByte(encoder, highByte);
+    }
+}
+
+// Find the length of an unsigned integer's encoding.
+static inline uint64 findUintSize(
+    uint64 value)
+{
+    return 1 + countUintBytes(value);
+}
+
+// Reserve a place for a container's element size, in the order containers are encoded.
+static uint32 reserveContainerSize(
+    vaEncoder *encoder)
+{
+    if(encoder->numContainerSizes == encoder->containerSizesSize) {
+        encoder->containerSizesSize <<= 1;
+        utResizeArray(encoder->containerSizes, encoder->containerSizesSize);
+    }
+    return encoder->numContainerSizes++;
+}
+
+// Find the length of a version 2 text encoding.
+static inline uint64 sizeText(
+    uchar *text)
+{
+    uint64 length = strlen((char *)text);
+
+    return 1 + findUintSize(length) + length + 1;
+}
+
+static uint64 sizeValue(vaEncoder *encoder, vaValue value);
+
+// Find the length of a version 2 tuple or list, and save the size of its elements.
+static uint64 sizeList(
+    vaEncoder *encoder,
+    vaList list)
+{
+    uint32 xSize = reserveContainerSize(encoder);
+    uint64 size = 0;
+    vaValue value;
+
+    vaForeachListValue(list, value) {
+        size += sizeValue(encoder, value);
+    } vaEndListValue;
+    encoder->containerSizes[xSize] = size;
+    return 1 + findUintSize(size) + findUintSize(vaListGetUsedValue(list)) + size;
+}
+
+// Find the length of a version 2 dictionary, and save the size of its entries.
+static uint64 sizeDictionary(
+    vaEncoder *encoder,
+    vaDictionary dictionary)
+{
+    uint32 xSize = reserveContainerSize(encoder);
+    uint64 size = 0;
+    uint32 xEntry;
+
+    vaForeachDictionaryEntry(dictionary, xEntry) {
+        size += sizeValue(encoder, vaDictionaryGetiKey(dictionary, xEntry));
+        size += sizeValue(encoder, vaDictionaryGetiValue(dictionary, xEntry));
+    } vaEndDictionaryEntry;
+    encoder->containerSizes[xSize] = size;
+    return 1 + findUintSize(size) + findUintSize(vaDictionaryGetNumEntries(dictionary)) + size;
+}
+
+// Find the length of the value's version 2 encoding.  This is done before encoding, so that
+// containers can start with their size.
+static uint64 sizeValue(
+    vaEncoder *encoder,
+    vaValue value)
+{
+    uint64 length;
+
+    switch(vaValueGetType(value)) {
+    case VA_POSINT: case VA_NEGINT: return findUintSize(vaValueGetUintVal(value));
+    case VA_OBJECT: return findUintSize(vaValueGetObjectVal(value));
+    case VA_BOOL: case VA_NULL: return 1;
+    case VA_FLOAT: return 5;
+    case VA_DOUBLE: return 9;
+    case VA_STRING: return sizeText(vaStringGetValue(vaValueGetStringVal(value)));
+    case VA_IDENT: return sizeText((uchar *)utSymGetName(vaValueGetNameVal(value)));
+    case VA_TUPLE: return sizeList(encoder, vaValueGetTupleVal(value));
+    case VA_LIST: return sizeList(encoder, vaValueGetListVal(value));
+    case VA_DICTIONARY: return sizeDictionary(encoder, vaValueGetDictionaryVal(value));
+    case VA_BLOB:
+        length = vaBlobGetLength(vaValueGetBlobVal(value));
+        return findUintSize(length) + length;
+    default:
+        utExit("Invalid encoded value");
     }
+    return 0; // Dummy return
 }
 
 // Encode a floating point number.
 static void encodeFloat(
+    vaEncoder *encoder,
     float value)
 {
-    uint8 *p = (uint8 *)(void *)&value;
+    uint32 bits;
     int i;
 
-    addByte('f');
-    for(i = 0; i < 4; i++) {
-        addByte(p[vaOrder32.byteArray[i]]);
+    if(encoder->canonical && value == 0.0f) {
+        value = 0.0f;
+    }
+    memcpy(&bits, &value, sizeof(float));
+    addByte(encoder, 'f');
+    for(i = 3; i >= 0; i--) {
+        addByte(encoder, bits >> (i << 3));
     }
 }
 
 // Encode a double precision floating point number.
 static void encodeDouble(
+    vaEncoder *encoder,
     double value)
 {
-    uint8 *p = (uint8 *)(void *)&value;
+    uint64 bits;
     int i;
 
-    addByte('g');
-    for(i = 0; i < 8; i++) {
-        addByte(p[vaOrder64.byteArray[i]]);
+    if(encoder->canonical && value == 0.0) {
+        value = 0.0;
+    }
+    memcpy(&bits, &value, sizeof(double));
+    addByte(encoder, 'g');
+    for(i = 7; i >= 0; i--) {
+        addByte(encoder, bits >> (i << 3));
+    }
+}
+
+// Encode zero-terminated text, after the type byte.  Version 2 puts the length first, but
+// still ends with a zero, so decoders can use the text in place.
+static void encodeText(
+    vaEncoder *encoder,
+    uint8 type,
+    uchar *p)
+{
+    uint64 length = strlen((char *)p);
+
+    if(encoder->version2) {
+        addByte(encoder, type == 's'? 'S' : 'I');
+        encodeUint(encoder, 0, length);
+    } else {
+        addByte(encoder, type);
     }
+    vaSinkWrite(encoder->sink, p, length + 1);
 }
 
 // Encode a string value.
-static void encodeString(
+static inline void encodeString(
+    vaEncoder *encoder,
     vaString string)
 {
-    uchar *p = vaStringGetValue(string);
-    uchar c;
-
-    addByte('s');
-    do {
-        c = *p++;
-        addByte(c);
-    } while(c != '\0');
+    encodeText(encoder, 's', vaStringGetValue(string));
 }
 
 // Encode an ident value.
-static void encodeIdent(
+static inline void encodeIdent(
+    vaEncoder *encoder,
     utSym sym)
 {
-    uchar *p = (uchar *)utSymGetName(sym);
-    uchar c;
+    encodeText(encoder, 'i', (uchar *)utSymGetName(sym));
+}
+
+// Start a tuple, list or dictionary.  Version 2 containers begin with the size of their
+// elements, found by sizeValue, and their element count.
+static void startContainer(
+    vaEncoder *encoder,
+    uint8 type,
+    uint8 version2Type,
+    uint64 count)
+{
+    if(encoder->version2) {
+        addByte(encoder, version2Type);
+        encodeUint(encoder, 0, encoder->containerSizes[encoder->containerSizePos++]);
+        encodeUint(encoder, 0, count);
+    } else {
+        addByte(encoder, type);
+    }
+}
 
-    addByte('i');
-    do {
-        c = *p++;
-        addByte(c);
-    } while(c != '\0');
+// End a tuple, list or dictionary.  Only version 1 containers need an end marker.
+static inline void endContainer(
+    vaEncoder *encoder)
+{
+    if(!encoder->version2) {
+        addByte(encoder, 'E');
+    }
 }
 
 // Encode a list of values.
 static void encodeList(
+    vaEncoder *encoder,
+    uint8 type,
+    uint8 version2Type,
     vaList list)
 {
     vaValue value;
 
+    startContainer(encoder, type, version2Type, vaListGetUsedValue(list));
     vaForeachListValue(list, value) {
-        bencode(value);
+        bencode(encoder, value);
     } vaEndListValue;
-    addByte('E');
+    endContainer(encoder);
+}
+
+// Compare encoded keys by their bytes.  A key that starts another sorts first.
+static int compareEncodedKeys(
+    const void *key1Ptr,
+    const void *key2Ptr)
+{
+    const vaEncodedKey *key1 = (const vaEncodedKey *)key1Ptr;
+    const vaEncodedKey *key2 = (const vaEncodedKey *)key2Ptr;
+    uint64 length = key1->length < key2->length? key1->length : key2->length;
+    int result = memcmp(key1->bytes, key2->bytes, length);
+
+    if(result != 0) {
+        return result;
+    }
+    return key1->length < key2->length? -1 : key1->length > key2->length;
+}
+
+// Encode the entries of a dictionary sorted by their encoded keys.  The keys are encoded to
+// a scratch sink first, and then copied out in order.
+static void encodeSortedEntries(
+    vaEncoder *encoder,
+    vaDictionary dictionary)
+{
+    uint32 numEntries = vaDictionaryGetNumEntries(dictionary);
+    vaEncodedKey *keys = utNewA(vaEncodedKey, numEntries);
+    vaEncoder keyEncoder = *encoder;
+    uint32 xEntry, xKey = 0;
+    uint8 *keyBytes;
+    uint64 length;
+
+    keyEncoder.sink = vaMemorySinkCreate();
+    vaForeachDictionaryEntry(dictionary, xEntry) {
+        keys[xKey].offset = keyEncoder.sink->used;
+        bencode(&keyEncoder, vaDictionaryGetiKey(dictionary, xEntry));
+        keys[xKey].length = keyEncoder.sink->used - keys[xKey].offset;
+        keys[xKey].xEntry = xEntry;
+        xKey++;
+    } vaEndDictionaryEntry;
+    // The scratch sink has stopped growing, so its bytes can be pointed to.
+    keyBytes = vaSinkGetBytes(keyEncoder.sink, &length);
+    for(xKey = 0; xKey < numEntries; xKey++) {
+        keys[xKey].bytes = keyBytes + keys[xKey].offset;
+    }
+    qsort(keys, numEntries, sizeof(vaEncodedKey), compareEncodedKeys);
+    for(xKey = 0; xKey < numEntries; xKey++) {
+        vaSinkWrite(encoder->sink, keys[xKey].bytes, keys[xKey].length);
+        bencode(encoder, vaDictionaryGetiValue(dictionary, keys[xKey].xEntry));
+    }
+    vaSinkDestroy(keyEncoder.sink);
+    utFree(keys);
 }
 
 // Encode a dictionary.
 static void encodeDictionary(
+    vaEncoder *encoder,
     vaDictionary dictionary)
 {
-    vaDictEntry dictEntry;
-
-    addByte('d');
-    vaForeachDictionaryDictEntry(dictionary, dictEntry) {
-        bencode(vaDictEntryGetKey(dictEntry));
-        bencode(vaDictEntryGetValue(dictEntry));
-    } vaEndDictionaryDictEntry;
-    addByte('E');
+    uint32 xEntry;
+
+    startContainer(encoder, 'd', 'D', vaDictionaryGetNumEntries(dictionary));
+    if(encoder->canonical && vaDictionaryGetNumEntries(dictionary) > 1) {
+        encodeSortedEntries(encoder, dictionary);
+    } else {
+        vaForeachDictionaryEntry(dictionary, xEntry) {
+            bencode(encoder, vaDictionaryGetiKey(dictionary, xEntry));
+            bencode(encoder, vaDictionaryGetiValue(dictionary, xEntry));
+        } vaEndDictionaryEntry;
+    }
+    endContainer(encoder);
 }
 
 // Encode a blob object.
 static void encodeBlob(
+    vaEncoder *encoder,
     vaBlob blob)
 {
     uint64 length = vaBlobGetLength(blob);
-    uint8 *p = vaBlobGetValue(blob);
 
-    encodeUint(3, length);
-    while(length--) {
-        addByte(*p++);
-    }
+    encodeUint(encoder, 3, length);
+    vaSinkWrite(encoder->sink, vaBlobGetValue(blob), length);
 }
 
-// Encode a value to a binary representation, and add it to the vaEncodedValue array.
+// Encode a value to a binary representation, and add it to the encoder's sink.
 static void bencode(
+    vaEncoder *encoder,
     vaValue value)
 {
     vaType type = vaValueGetType(value);
 
     switch(type) {
-    case VA_POSINT: encodeUint(0, vaValueGetUintVal(value)); break;
-    case VA_NEGINT: encodeUint(1, vaValueGetUintVal(value)); break;
-    case VA_OBJECT: encodeUint(2, vaValueGetObjectVal(value)); break;
+    case VA_POSINT: encodeUint(encoder, 0, vaValueGetUintVal(value)); break;
+    case VA_NEGINT: encodeUint(encoder, 1, vaValueGetUintVal(value)); break;
+    case VA_OBJECT: encodeUint(encoder, 2, vaValueGetObjectVal(value)); break;
     case VA_BOOL:
         if(vaValueBoolVal(value)) {
-            addByte('T');
+            addByte(encoder, 'T');
         } else {
-            addByte('F');
+            addByte(encoder, 'F');
         }
         break;
-    case VA_NULL: addByte('0'); break;
-    case VA_FLOAT: encodeFloat(vaValueGetFloatVal(value)); break;
-    case VA_DOUBLE: encodeDouble(vaValueGetDoubleVal(value)); break;
-    case VA_STRING: encodeString(vaValueGetStringVal(value)); break;
-    case VA_IDENT: encodeIdent(vaValueGetNameVal(value)); break;
-    case VA_TUPLE: addByte('t'); encodeList(vaValueGetTupleVal(value)); break;
-    case VA_LIST: addByte('l'); encodeList(vaValueGetListVal(value)); break;
-    case VA_DICTIONARY: encodeDictionary(vaValueGetDictionaryVal(value)); break;
-    case VA_BLOB: encodeBlob(vaValueGetBlobVal(value)); break;
+    case VA_NULL: addByte(encoder, '0'); break;
+    case VA_FLOAT: encodeFloat(encoder, vaValueGetFloatVal(value)); break;
+    case VA_DOUBLE: encodeDouble(encoder, vaValueGetDoubleVal(value)); break;
+    case VA_STRING: encodeString(encoder, vaValueGetStringVal(value)); break;
+    case VA_IDENT: encodeIdent(encoder, vaValueGetNameVal(value)); break;
+    case VA_TUPLE: encodeList(encoder, 't', 'P', vaValueGetTupleVal(value)); break;
+    case VA_LIST: encodeList(encoder, 'l', 'L', vaValueGetListVal(value)); break;
+    case VA_DICTIONARY: encodeDictionary(encoder, vaValueGetDictionaryVal(value)); break;
+    case VA_BLOB: encodeBlob(encoder, vaValueGetBlobVal(value)); break;
     default:
         utExit("Invalid encoded value");
     }
 }
 
-// Encode a value to a binary representation.  This returns a utBuffer, so use it soon.
+// Encode a value to the sink.  Nothing is flushed, so call vaSinkFlush when done.
+void vaBencodeToSink(
+    vaSink sink,
+    vaValue value)
+{
+    vaEncoder encoder = createEncoder(sink);
+
+    bencode(&encoder, value);
+}
+
+// Encode a value to the sink in version 2 of the encoding.  Container sizes are found in a
+// pass before encoding, which needs memory in proportion to the number of containers.
+void vaBencode2ToSink(
+    vaSink sink,
+    vaValue value)
+{
+    vaEncoder encoder = {sink, true, false, NULL, 42, 0, 0};
+
+    encoder.containerSizes = utNewA(uint64, encoder.containerSizesSize);
+    sizeValue(&encoder, value);
+    bencode(&encoder, value);
+    utFree(encoder.containerSizes);
+}
+
+// Encode a value to the sink in canonical form.  This is version 1 of the encoding, with
+// dictionary entries sorted by their encoded keys, and zeros written without a sign.  Values
+// that differ only in the order of their dictionary entries encode the same, so canonical
+// encodings can be hashed or compared to find duplicates.
+void vaBencodeCanonicalToSink(
+    vaSink sink,
+    vaValue value)
+{
+    vaEncoder encoder = {sink, false, true, NULL, 0, 0, 0};
+
+    bencode(&encoder, value);
+}
+
+// Return the 64-bit hash of the value's canonical encoding.  The encoding is hashed as it is
+// written, in chunks, and is never held in memory.
+uint64 vaCanonicalHash(
+    vaValue value)
+{
+    vaHasher hasher;
+    vaSink sink;
+
+    vaHasherStart(&hasher, 0);
+    sink = vaHashSinkCreate(&hasher);
+    vaBencodeCanonicalToSink(sink, value);
+    vaSinkFlush(sink);
+    vaSinkDestroy(sink);
+    return vaHasherFinish(&hasher);
+}
+
+// The vaBencodeAdd functions encode a value piece by piece to a sink, for data that is not
+// held in vaValues.  Tuples and lists are started, their values added, and then ended.  The
+// pieces are written in version 1 of the encoding, which needs no sizes up front.
+
+// Add a value to the encoding.
+void vaBencodeAddValue(
+    vaSink sink,
+    vaValue value)
+{
+    vaBencodeToSink(sink, value);
+}
+
+// Add an unsigned integer to the encoding.
+void vaBencodeAddUint(
+    vaSink sink,
+    uint64 value)
+{
+    vaEncoder encoder = createEncoder(sink);
+
+    encodeUint(&encoder, 0, value);
+}
+
+// Add a bool to the encoding.
+void vaBencodeAddBool(
+    vaSink sink,
+    bool value)
+{
+    vaSinkAddByte(sink, value? 'T' : 'F');
+}
+
+// Add a null to the encoding.
+void vaBencodeAddNull(
+    vaSink sink)
+{
+    vaSinkAddByte(sink, '0');
+}
+
+// Add a string to the encoding.
+void vaBencodeAddString(
+    vaSink sink,
+    uchar *string)
+{
+    vaEncoder encoder = createEncoder(sink);
+
+    encodeText(&encoder, 's', string);
+}
+
+// Add an ident to the encoding.
+void vaBencodeAddIdent(
+    vaSink sink,
+    utSym sym)
+{
+    vaEncoder encoder = createEncoder(sink);
+
+    encodeIdent(&encoder, sym);
+}
+
+// Start a tuple.  Add its values, and then call vaBencodeEndList.
+void vaBencodeStartTuple(
+    vaSink sink)
+{
+    vaSinkAddByte(sink, 't');
+}
+
+// Start a list.  Add its values, and then call vaBencodeEndList.
+void vaBencodeStartList(
+    vaSink sink)
+{
+    vaSinkAddByte(sink, 'l');
+}
+
+// End a tuple or list.
+void vaBencodeEndList(
+    vaSink sink)
+{
+    vaSinkAddByte(sink, 'E');
+}
+
+// Copy the bytes of a memory sink to a utBuffer.
+static uchar *copySinkBytes(
+    vaSink sink,
+    uint64 *length)
+{
+    uint8 *encoding = vaSinkGetBytes(sink, length);
+    uchar *bytes = utNewBufA(uchar, *length);
+
+    memcpy(bytes, encoding, *length);
+    return bytes;
+}
+
+// Encode a value to a binary representation.  This returns a utBuffer, so use it soon.  The
+// encoding is built in a shared sink, so use vaBencodeToSink on other threads.
 uchar *vaBencode(
     vaValue value,
     uint64 *length)
 {
-    uchar *bytes;
+    vaSinkClear(vaBencodeSink);
+    vaBencodeToSink(vaBencodeSink, value);
+    return copySinkBytes(vaBencodeSink, length);
+}
 
-    vaValuePos = 0;
-    bencode(value);
-    *length = vaValuePos;
-    bytes = utNewBufA(uchar, vaValuePos);
-    memcpy(bytes, vaEncodedValue, vaValuePos);
-    return bytes;
+// Encode a value in version 2 of the encoding, which can be skipped over without reading
+// it.  This returns a utBuffer, so use it soon.  Like vaBencode, it uses a shared sink.
+uchar *vaBencode2(
+    vaValue value,
+    uint64 *length)
+{
+    vaSinkClear(vaBencodeSink);
+    vaBencode2ToSink(vaBencodeSink, value);
+    return copySinkBytes(vaBencodeSink, length);
 }
 
 // Check that everything works for the string.  Encode and decode it, and verify the values are
@@ -636,7 +1044,7 @@ static void selfTest(
     bool shouldPass,
     bool preciseFloats)
 {
-    uint64 length;
+    uint64 length, decodedLength;
     vaValue value1, value2;
     uint8 *bytes;
     uchar *finalValue;
@@ -644,11 +1052,26 @@ static void selfTest(
     printf("Starting %s\n", string);
     value1 = vaParseValue(string);
     bytes = vaBencode(value1, &length);
-    value2 = vaBdecode(bytes);
+    value2 = vaBdecodeLength(bytes, &decodedLength);
+    if(decodedLength != length) {
+        utExit("Wrong decoded length for %s", string);
+    }
     if(!vaValuesEqual(value1, value2)) {
         utExit("Failed encode/decode test: %s != \n", vaValue2String(value1),
             vaValue2String(value2));
     }
+    bytes = vaBencode2(value1, &length);
+    if(vaFindEncodedValueLength(bytes) != length) {
+        utExit("Wrong version 2 length for %s", string);
+    }
+    value2 = vaBdecodeLength(bytes, &decodedLength);
+    if(decodedLength != length) {
+        utExit("Wrong version 2 decoded length for %s", string);
+    }
+    if(!vaValuesEqual(value1, value2)) {
+        utExit("Failed version 2 encode/decode test: %s != \n", vaValue2String(value1),
+            vaValue2String(value2));
+    }
     finalValue = preciseFloats? vaValue2PreciseString(value2) : vaValue2String(value2);
     if(shouldPass) {
         if(strcmp((char *)string, (char *)finalValue)) {
@@ -658,6 +1081,181 @@ static void selfTest(
     printf("Passed %s -> %s\n", string, finalValue);
 }
 
+// Fill text with a container of numElements copies of element, between open and close.
+static uint64 buildLargeText(
+    uchar *text,
+    char *open,
+    char *element,
+    uint32 numElements,
+    char *close)
+{
+    uint64 length = strlen(open);
+    uint32 xElement;
+
+    memcpy(text, open, length);
+    for(xElement = 0; xElement < numElements; xElement++) {
+        if(xElement != 0) {
+            text[length++] = ',';
+        }
+        memcpy(text + length, element, strlen(element));
+        length += strlen(element);
+    }
+    strcpy((char *)text + length, close);
+    return length + strlen(close);
+}
+
+// Check that parsing a container large enough to split across threads gives the same value
+// as parsing it on one thread, and that a closing bracket not matching the opening one is
+// still an error.
+static void parallelSelfTest(void)
+{
+    uint32 numElements = 200000;
+    uchar *text = utNewA(uchar, numElements*16 + 16);
+    vaValue value1, value2;
+    char *message;
+    uint64 offset;
+
+    buildLargeText(text, "[", "(12345, x)", numElements, "]");
+    vaSetParseThreads(1);
+    value1 = vaParseValue(text);
+    vaSetParseThreads(4);
+    value2 = vaParseValue(text);
+    if(!vaValuesEqual(value1, value2)) {
+        utExit("Parallel parse differs from sequential parse");
+    }
+    vaValueDestroyUnshared(value1);
+    vaValueDestroyUnshared(value2);
+    buildLargeText(text, "[", "(12345, x)", numElements, ")");
+    if(vaTryParseValue(text, &message, &offset) != vaValueNull) {
+        utExit("Parallel parse accepted [ ... )");
+    }
+    buildLargeText(text, "<|", "a:12345", numElements, "|>");
+    if(vaTryParseValue(text, &message, &offset) == vaValueNull) {
+        utExit("Parallel parse rejected <| ... |>: %s", message);
+    }
+    buildLargeText(text, "<|", "a:12345", numElements, "]");
+    if(vaTryParseValue(text, &message, &offset) != vaValueNull) {
+        utExit("Parallel parse accepted <| ... ]");
+    }
+    vaSetParseThreads(1);
+    utFree(text);
+    printf("Passed parallel parsing\n");
+}
+
+// Check that dictionaries holding the same entries in a different order have the same
+// canonical encoding, with keys in order, and the same canonical hash.
+static void canonicalSelfTest(void)
+{
+    vaValue value1 = vaParseValue((uchar *)"<|b:1, a:(2, <|y:3, x:4|>)|>");
+    vaValue value2 = vaParseValue((uchar *)"<|a:(2, <|x:4, y:3|>), b:1|>");
+    vaValue value3;
+    vaSink sink1 = vaMemorySinkCreate();
+    vaSink sink2 = vaMemorySinkCreate();
+    uint8 *bytes1, *bytes2;
+    uint64 length1, length2;
+
+    vaBencodeCanonicalToSink(sink1, value1);
+    vaBencodeCanonicalToSink(sink2, value2);
+    bytes1 = vaSinkGetBytes(sink1, &length1);
+    bytes2 = vaSinkGetBytes(sink2, &length2);
+    if(length1 != length2 || memcmp(bytes1, bytes2, length1)) {
+        utExit("Canonical encoding depends on insertion order");
+    }
+    if(strcmp((char *)vaEncodedViewGetText(vaEncodedViewGetFirst(
+            vaEncodedViewCreate(bytes1))), "a")) {
+        utExit("Canonical encoding has keys out of order");
+    }
+    value3 = vaParseValue((uchar *)"<|a:2, b:1|>");
+    if(vaCanonicalHash(value1) != vaCanonicalHash(value2) ||
+            vaCanonicalHash(value1) == vaCanonicalHash(value3)) {
+        utExit("Wrong canonical hash");
+    }
+    vaSinkDestroy(sink1);
+    vaSinkDestroy(sink2);
+    printf("Passed canonical encoding\n");
+}
+
+// Check a path query on the encoding.  A negative expected value means not found.
+static void checkQuery(
+    uint8 *bytes,
+    char *path,
+    int64 expected)
+{
+    vaEncodedView view = vaEncodedQuery(vaEncodedViewCreate(bytes), path);
+
+    if(expected < 0? view.bytes != NULL :
+            view.bytes == NULL || vaEncodedViewGetUint(view) != (uint64)expected) {
+        utExit("Wrong result for query %s", path);
+    }
+}
+
+// Check path queries, including quoted keys with escapes, on both versions of the encoding.
+static void querySelfTest(void)
+{
+    vaValue value = vaParseValue((uchar *)"<|user:<|\"first name\":1, \"a\\\"b\":2, "
+        "\"c\\\\d\":3, name:4|>, list:[10, 20, (30, 40)]|>");
+    uint8 *bytes;
+    uint64 length;
+    uint32 version;
+
+    for(version = 1; version <= 2; version++) {
+        bytes = version == 1? vaBencode(value, &length) : vaBencode2(value, &length);
+        checkQuery(bytes, "user[\"first name\"]", 1);
+        checkQuery(bytes, "user[\"a\\\"b\"]", 2);
+        checkQuery(bytes, ".user[\"c\\\\d\"]", 3);
+        checkQuery(bytes, "user.name", 4);
+        checkQuery(bytes, "user[\"name\"]", -1);
+        checkQuery(bytes, "user.missing", -1);
+        checkQuery(bytes, "list[2][1]", 40);
+        checkQuery(bytes, "list[3]", -1);
+    }
+    printf("Passed encoded queries\n");
+}
+
+// Check that the push decoder finds values of both versions in a stream pushed a byte at a
+// time, and fails on a bad stream rather than exiting.
+static void decoderSelfTest(void)
+{
+    vaValue value1 = vaParseValue((uchar *)"<|a:[1, \"two\", 3.5], b:(0b0102, \\true)|>");
+    vaValue value2 = vaParseValue((uchar *)"[-300, \"text\", <|x:()|>]");
+    vaValue value;
+    vaDecoder decoder;
+    uint8 *bytes, *stream;
+    uint64 length1, length2, pos;
+    uint32 numValues = 0;
+
+    bytes = vaBencode(value1, &length1);
+    stream = utNewA(uint8, length1);
+    memcpy(stream, bytes, length1);
+    bytes = vaBencode2(value2, &length2);
+    utResizeArray(stream, length1 + length2);
+    memcpy(stream + length1, bytes, length2);
+    decoder = vaDecoderCreate(16);
+    for(pos = 0; pos < length1 + length2; pos++) {
+        vaDecoderPush(decoder, stream + pos, 1);
+        while((value = vaDecoderNext(decoder)) != vaValueNull) {
+            if(!vaValuesEqual(value, numValues == 0? value1 : value2)) {
+                utExit("Push decoder returned the wrong value");
+            }
+            numValues++;
+        }
+    }
+    if(numValues != 2 || vaDecoderHasPartialValue(decoder) || vaDecoderFailed(decoder)) {
+        utExit("Push decoder did not find both values");
+    }
+    vaDecoderDestroy(decoder);
+    decoder = vaDecoderCreate(16);
+    vaDecoderPush(decoder, (uint8 *)"lE", 2);
+    vaDecoderNext(decoder);
+    vaDecoderPush(decoder, (uint8 *)"E", 1);
+    if(vaDecoderNext(decoder) != vaValueNull || !vaDecoderFailed(decoder)) {
+        utExit("Push decoder accepted an unmatched E");
+    }
+    vaDecoderDestroy(decoder);
+    utFree(stream);
+    printf("Passed push decoding\n");
+}
+
 typedef struct {
     char *value;
     bool shouldPass;
@@ -686,6 +1284,10 @@ void vaBencodeSelfTest(void)
         {"<|a:1, b:2, 1.23:3.333|>", true, false},
         {"\\false", true, false},
         {"<|[(0, 1), (2, 3)]:(a, b), <|[4, 5, 6]:false|>:\\true|>", true, false},
+        {"0b000102030405060708090A0B0C0D0E0F101112131415161718191A1B1C1D1E1F2021", true, false},
+        {"\"A string longer than sixteen bytes, with \\\"quotes\\\" and a \\\\\"", true,
+            false},
+        {"[(), [], <||>, (())]", true, false},
         {NULL, false, false},
     };
     vaTestType test;
@@ -695,6 +1297,10 @@ void vaBencodeSelfTest(void)
         test = tests[xTest];
         selfTest((uchar *)test.value, test.shouldPass, test.preciseFloats);
     }
+    canonicalSelfTest();
+    querySelfTest();
+    decoderSelfTest();
+    parallelSelfTest();
     printf("\n");
 }
 
@@ -1,7 +1,17 @@
-// Blob methods
+/* Blob methods.  A blob either owns its malloced bytes, or borrows them from a vaRegion,
+   which it holds a reference to.  Borrowed bytes must not be modified.
+
+   Blobs are written in text as pairs of hex digits.  The hex codec works 16 bytes at a time
+   where SSE2 is available, and decodes straight into the blob's memory. */
+
 #include <stdlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "value.h"
 
+static const uchar vaHexDigits[] = "0123456789ABCDEF";
+
 // Create a new binary blob object.
 vaBlob vaBlobCreate(
     uint64 length,
@@ -16,11 +26,48 @@ vaBlob vaBlobCreate(
     return blob;
 }
 
-// Destructor hook for freeing blob data.
+// Create a blob from pairs of hex digits that have already been checked.  The bytes are
+// decoded directly into the blob's memory.
+vaBlob vaBlobCreateFromHex(
+    uchar *text,
+    uint64 length)
+{
+    vaBlob blob = vaBlobAlloc();
+    uint8 *bytes = (uint8 *)malloc(length);
+
+    vaHexDecode(text, bytes, length);
+    vaBlobSetLength(blob, length);
+    vaBlobSetValue(blob, bytes);
+    return blob;
+}
+
+// Create a blob that borrows its bytes from a region, without copying them.  The blob holds
+// a reference to the region until it is destroyed.
+vaBlob vaBlobCreateBorrowed(
+    vaRegion region,
+    uint8 *bytes,
+    uint64 length)
+{
+    vaBlob blob = vaBlobAlloc();
+
+    vaRegionRef(region);
+    vaBlobSetLength(blob, length);
+    vaBlobSetValue(blob, bytes);
+    vaBlobSetRegion(blob, region);
+    return blob;
+}
+
+// Destructor hook for freeing blob data, or dropping the reference to borrowed data.
 void vaFreeBlobData(
     vaBlob blob)
 {
-    free(vaBlobGetValue(blob));
+    vaRegion region = vaBlobGetRegion(blob);
+
+    if(region != NULL) {
+        vaRegionUnref(region);
+    } else {
+        free(vaBlobGetValue(blob));
+    }
 }
 
 // Compare two blobs.
@@ -30,8 +77,159 @@ bool vaBlobsEqual(
 {
     uint64 length = vaBlobGetLength(blob1);
 
-    if(vaBlobGetLength(blob2) != length) {
+    if(vaBlobGetLength(blob2) != length ||
+            vaHashesDiffer(vaBlobGetHash(blob1), vaBlobGetHash(blob2))) {
         return false;
     }
     return !memcmp(vaBlobGetValue(blob1), vaBlobGetValue(blob2), length);
 }
+
+// Hash the bytes of the blob.  The hash is cached on the blob.
+uint32 vaBlobHash(
+    vaBlob blob)
+{
+    uint32 hash = vaBlobGetHash(blob);
+    uint64 length;
+
+    if(hash != 0) {
+        return hash;
+    }
+    length = vaBlobGetLength(blob);
+    hash = length == 0? 1 : utHashData(vaBlobGetValue(blob), length);
+    if(hash == 0) {
+        hash = 1;
+    }
+    vaBlobSetHash(blob, hash);
+    return hash;
+}
+
+// Return true if the character is a hex digit.
+static inline bool isHexDigit(
+    uchar c)
+{
+    return (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'f');
+}
+
+// Return a pointer to the first character in the zero-terminated text that is not a hex
+// digit.
+uchar *vaSkipHexDigits(
+    uchar *text)
+{
+#ifdef __SSE2__
+    __m128i caseBit = _mm_set1_epi8(0x20);
+    __m128i bytes, lower;
+    uint32 mask;
+
+    // Aligned loads never cross into the next page, so they can't fault past the zero.
+    while(((uintptr_t)text & 15) != 0) {
+        if(!isHexDigit(*text)) {
+            return text;
+        }
+        text++;
+    }
+    while(true) {
+        // Bytes over 0x7f are negative, so they fail the signed range checks.
+        bytes = _mm_load_si128((__m128i *)text);
+        lower = _mm_or_si128(bytes, caseBit);
+        mask = _mm_movemask_epi8(_mm_or_si128(
+            _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8('0' - 1)),
+                _mm_cmplt_epi8(bytes, _mm_set1_epi8('9' + 1))),
+            _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)))));
+        if(mask != 0xffff) {
+            return text + __builtin_ctz(~mask);
+        }
+        text += 16;
+    }
+#else
+    while(isHexDigit(*text)) {
+        text++;
+    }
+    return text;
+#endif
+}
+
+// Convert a checked hex digit into its value.  Letters have bit 0x40 set, and their low
+// bits are 1 through 6.
+static inline uint8 hexValue(
+    uchar c)
+{
+    return (c & 0xf) + 9*(c >> 6);
+}
+
+#ifdef __SSE2__
+// Convert 16 checked hex digits into 8 bytes, held in the low byte of each 16 bit lane.
+static inline __m128i decodeHex16(
+    uchar *text)
+{
+    __m128i digits = _mm_loadu_si128((__m128i *)text);
+    __m128i values = _mm_add_epi8(_mm_and_si128(digits, _mm_set1_epi8(0xf)),
+        _mm_and_si128(_mm_cmpgt_epi8(digits, _mm_set1_epi8(0x40)), _mm_set1_epi8(9)));
+
+    // The first digit of each pair is the high nibble, and is the low byte of the lane.
+    return _mm_or_si128(_mm_slli_epi16(_mm_and_si128(values, _mm_set1_epi16(0xff)), 4),
+        _mm_srli_epi16(values, 8));
+}
+#endif
+
+// Decode length bytes from pairs of hex digits, which must already have been checked.
+void vaHexDecode(
+    uchar *text,
+    uint8 *bytes,
+    uint64 length)
+{
+#ifdef __SSE2__
+    while(length >= 16) {
+        _mm_storeu_si128((__m128i *)bytes, _mm_packus_epi16(decodeHex16(text),
+            decodeHex16(text + 16)));
+        text += 32;
+        bytes += 16;
+        length -= 16;
+    }
+#endif
+    while(length--) {
+        *bytes++ = (hexValue(text[0]) << 4) | hexValue(text[1]);
+        text += 2;
+    }
+}
+
+#ifdef __SSE2__
+// Convert 16 nibbles into upper case hex digits.
+static inline __m128i encodeHex16(
+    __m128i nibbles)
+{
+    __m128i letters = _mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9));
+
+    return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')),
+        _mm_and_si128(letters, _mm_set1_epi8('A' - '0' - 10)));
+}
+#endif
+
+// Write each byte as two upper case hex digits.  The text must have room for 2*length
+// characters, and is not zero-terminated.
+void vaHexEncode(
+    uint8 *bytes,
+    uint64 length,
+    uchar *text)
+{
+    uint8 value;
+#ifdef __SSE2__
+    __m128i values, high, low;
+
+    while(length >= 16) {
+        values = _mm_loadu_si128((__m128i *)bytes);
+        high = encodeHex16(_mm_and_si128(_mm_srli_epi16(values, 4), _mm_set1_epi8(0xf)));
+        low = encodeHex16(_mm_and_si128(values, _mm_set1_epi8(0xf)));
+        _mm_storeu_si128((__m128i *)text, _mm_unpacklo_epi8(high, low));
+        _mm_storeu_si128((__m128i *)(text + 16), _mm_unpackhi_epi8(high, low));
+        bytes += 16;
+        text += 32;
+        length -= 16;
+    }
+#endif
+    while(length--) {
+        value = *bytes++;
+        *text++ = vaHexDigits[value >> 4];
+        *text++ = vaHexDigits[value & 0xf];
+    }
+}
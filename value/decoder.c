@@ -0,0 +1,269 @@
+/* Push-mode bencode decoder.  Callers push chunks of a byte stream as they arrive, such as
+   reads from a pipe, and pull out each top-level value once its last byte has arrived.  A
+   stream can hold any number of concatenated values, in either version of the encoding.
+
+   Each byte is scanned once, and the scanner's state carries over between chunks.  Values
+   that lie within one chunk are decoded straight from the caller's bytes.  Only a value
+   split across chunks is copied, into the decoder's buffer, and only its own bytes.
+
+   The stream may come from an untrusted peer, so each complete value is checked with
+   vaEncodingValid before it is decoded.  Bad bytes put the decoder in a failed state,
+   rather than exiting, and the stream cannot be resynchronized after that. */
+
+#include "value.h"
+
+#define VA_MAX_HEADER 20 // Type byte, and two encoded uints
+
+struct vaDecoderStruct {
+    uint8 *chunk; // The caller's bytes, which must stay valid until vaDecoderNext fails
+    uint64 chunkLength, chunkPos;
+    uint8 *buffer; // Bytes of a value split across chunks
+    uint64 bufferSize, bufferUsed;
+    uint64 skip; // Bytes left of a payload with a known length
+    uint32 depth; // Version 1 containers still waiting for their 'E'
+    uint32 maxDepth; // Deepest nesting of containers accepted
+    uint8 header[VA_MAX_HEADER]; // Type byte and lengths, which may be split across chunks
+    uint32 headerUsed;
+    bool inText; // In zero-terminated version 1 text
+    bool failed; // The stream held an invalid value
+};
+
+// Create a decoder that accepts values nested no deeper than maxDepth.
+vaDecoder vaDecoderCreate(
+    uint32 maxDepth)
+{
+    vaDecoder decoder = utNew(struct vaDecoderStruct);
+
+    memset(decoder, 0, sizeof(struct vaDecoderStruct));
+    decoder->maxDepth = maxDepth;
+    decoder->bufferSize = 256;
+    decoder->buffer = utNewA(uint8, decoder->bufferSize);
+    return decoder;
+}
+
+// Destroy the decoder.
+void vaDecoderDestroy(
+    vaDecoder decoder)
+{
+    utFree(decoder->buffer);
+    utFree(decoder);
+}
+
+// Give the decoder the next chunk of the stream.  The bytes are not copied, so they must stay
+// valid until vaDecoderNext returns vaValueNull.  The last chunk must be used up.
+void vaDecoderPush(
+    vaDecoder decoder,
+    uint8 *bytes,
+    uint64 length)
+{
+    utAssert(decoder->failed || decoder->chunkPos == decoder->chunkLength);
+    decoder->chunk = bytes;
+    decoder->chunkLength = length;
+    decoder->chunkPos = 0;
+}
+
+// Return true if the decoder holds part of a value.  At the end of a stream, this means it
+// was truncated.
+bool vaDecoderHasPartialValue(
+    vaDecoder decoder)
+{
+    return decoder->bufferUsed != 0;
+}
+
+// Return true if the stream held an invalid value.  The decoder returns no more values.
+bool vaDecoderFailed(
+    vaDecoder decoder)
+{
+    return decoder->failed;
+}
+
+// Return true if the type starts a value with a header of lengths or a fixed-size payload.
+static inline bool hasHeader(
+    uint8 type)
+{
+    if(type & 0x80) {
+        return true;
+    }
+    switch(type) {
+    case 'f': case 'g': case 'S': case 'I': case 'P': case 'L': case 'D':
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Return true if the header is complete, and set the number of payload bytes after it.
+static bool readHeader(
+    vaDecoder decoder)
+{
+    uint8 *header = decoder->header;
+    uint32 used = decoder->headerUsed;
+    uint8 type = header[0];
+    uint32 sizeLength, countLength;
+
+    if(type & 0x80) {
+        // Integers, object IDs and blob lengths.
+        if(used < (type & 0x7) + 2u) {
+            return false;
+        }
+        if(((type >> 3) & 0xf) == 3) {
+            decoder->skip = vaDecodeUint(header);
+        }
+    } else if(type == 'f' || type == 'g') {
+        decoder->skip = type == 'f'? 4 : 8;
+    } else if(type == 'S' || type == 'I') {
+        if(used < 2 || used < (header[1] & 0x7) + 3u) {
+            return false;
+        }
+        decoder->skip = vaDecodeUint(header + 1) + 1;
+    } else {
+        // Version 2 containers are skipped by their size.
+        if(used < 2) {
+            return false;
+        }
+        sizeLength = (header[1] & 0x7) + 2;
+        if(used < sizeLength + 2) {
+            return false;
+        }
+        countLength = (header[sizeLength + 1] & 0x7) + 2;
+        if(used < sizeLength + countLength + 1) {
+            return false;
+        }
+        decoder->skip = vaDecodeUint(header + 1);
+    }
+    decoder->headerUsed = 0;
+    return true;
+}
+
+// Scan bytes of the current value.  Return the number of bytes that belong to it, and set
+// complete if they finish it.  Set failed on a byte that cannot start a value.
+static uint64 scanValue(
+    vaDecoder decoder,
+    uint8 *bytes,
+    uint64 length,
+    bool *complete)
+{
+    uint8 *p = bytes;
+    uint8 *end = bytes + length;
+    uint8 *zero;
+    uint64 numBytes;
+
+    *complete = false;
+    while(p < end) {
+        if(decoder->skip != 0) {
+            numBytes = end - p;
+            if(decoder->skip < numBytes) {
+                numBytes = decoder->skip;
+            }
+            p += numBytes;
+            decoder->skip -= numBytes;
+            if(decoder->skip != 0) {
+                break;
+            }
+        } else if(decoder->inText) {
+            zero = (uint8 *)memchr(p, '\0', end - p);
+            if(zero == NULL) {
+                p = end;
+                break;
+            }
+            p = zero + 1;
+            decoder->inText = false;
+        } else if(decoder->headerUsed != 0 || hasHeader(*p)) {
+            decoder->header[decoder->headerUsed++] = *p++;
+            if(!readHeader(decoder) || decoder->skip != 0) {
+                continue;
+            }
+        } else {
+            switch(*p++) {
+            case 't': case 'l': case 'd':
+                if(++decoder->depth > decoder->maxDepth) {
+                    decoder->failed = true;
+                    return 0;
+                }
+                continue;
+            case 's': case 'i':
+                decoder->inText = true;
+                continue;
+            case 'E':
+                if(decoder->depth == 0) {
+                    decoder->failed = true;
+                    return 0;
+                }
+                decoder->depth--;
+                break;
+            case 'T': case 'F': case '0':
+                break;
+            default:
+                decoder->failed = true;
+                return 0;
+            }
+        }
+        // A value just ended.  If it was not inside a container, the top value is done.
+        if(decoder->depth == 0) {
+            *complete = true;
+            break;
+        }
+    }
+    return p - bytes;
+}
+
+// Copy bytes of a value split across chunks into the buffer.
+static void appendToBuffer(
+    vaDecoder decoder,
+    uint8 *bytes,
+    uint64 length)
+{
+    if(decoder->bufferUsed + length > decoder->bufferSize) {
+        while(decoder->bufferUsed + length > decoder->bufferSize) {
+            decoder->bufferSize <<= 1;
+        }
+        utResizeArray(decoder->buffer, decoder->bufferSize);
+    }
+    memcpy(decoder->buffer + decoder->bufferUsed, bytes, length);
+    decoder->bufferUsed += length;
+}
+
+// Check the bytes of a complete value, and decode it.  Return vaValueNull and mark the
+// decoder failed if they are invalid.
+static vaValue decodeValue(
+    vaDecoder decoder,
+    uint8 *bytes,
+    uint64 length)
+{
+    if(!vaEncodingValid(bytes, length, decoder->maxDepth)) {
+        decoder->failed = true;
+        return vaValueNull;
+    }
+    return vaBdecode(bytes);
+}
+
+// Return the next complete top-level value, or vaValueNull if more bytes must be pushed
+// first, or if the stream is invalid, which vaDecoderFailed reports.
+vaValue vaDecoderNext(
+    vaDecoder decoder)
+{
+    uint8 *bytes = decoder->chunk + decoder->chunkPos;
+    uint64 length;
+    bool complete;
+    vaValue value;
+
+    if(decoder->failed || decoder->chunkPos == decoder->chunkLength) {
+        return vaValueNull;
+    }
+    length = scanValue(decoder, bytes, decoder->chunkLength - decoder->chunkPos, &complete);
+    if(decoder->failed) {
+        return vaValueNull;
+    }
+    decoder->chunkPos += length;
+    if(!complete) {
+        appendToBuffer(decoder, bytes, length);
+        return vaValueNull;
+    }
+    if(decoder->bufferUsed == 0) {
+        return decodeValue(decoder, bytes, length);
+    }
+    appendToBuffer(decoder, bytes, length);
+    value = decodeValue(decoder, decoder->buffer, decoder->bufferUsed);
+    decoder->bufferUsed = 0;
+    return value;
+}
@@ -1,13 +1,20 @@
 // Dictionary methods.  Note that this is an ordered dictionary.
+//
+// Entries are kept densely in insertion order, and the slot table maps key hashes to entry
+// positions, probing like Python's dict.  Deleting an entry leaves a hole in the entries
+// and a deleted marker in its slot, and both are squeezed out when the table is resized.
 #include "value.h"
 
-// Compare two entries.
-static inline bool dictEntriesEqual(
-    vaDictEntry dictEntry1,
-    vaDictEntry dictEntry2)
+#define VA_EMPTY_SLOT 0
+#define VA_DELETED_SLOT UINT32_MAX
+#define VA_MIN_SLOTS 8
+
+// Return the number of entries that fit before a table of numSlots must grow.  Keeping
+// it under 2/3 full guarantees empty slots to end probes.
+static inline uint32 findUsableEntries(
+    uint32 numSlots)
 {
-    return vaValuesEqual(vaDictEntryGetKey(dictEntry1), vaDictEntryGetKey(dictEntry2)) &&
-        vaValuesEqual(vaDictEntryGetValue(dictEntry1), vaDictEntryGetValue(dictEntry2));
+    return (numSlots << 1)/3;
 }
 
 // Compare two dictionaries.  They are not equal if the entries are not in the same order.
@@ -15,17 +22,161 @@ bool vaDictionariesEqual(
     vaDictionary dict1,
     vaDictionary dict2)
 {
-    vaDictEntry dictEntry1 = vaDictionaryGetFirstDictEntry(dict1);
-    vaDictEntry dictEntry2 = vaDictionaryGetFirstDictEntry(dict2);
+    uint32 used1 = vaDictionaryGetUsedEntries(dict1);
+    uint32 used2 = vaDictionaryGetUsedEntries(dict2);
+    uint32 xEntry1 = 0, xEntry2 = 0;
+    vaValue key1, key2;
 
-    while(dictEntry1 != vaDictEntryNull && dictEntry2 != vaDictEntryNull) {
-        if(!dictEntriesEqual(dictEntry1, dictEntry2)) {
+    if(dict1 == dict2) {
+        return true;
+    }
+    if(vaDictionaryGetNumEntries(dict1) != vaDictionaryGetNumEntries(dict2) ||
+            vaHashesDiffer(vaDictionaryGetHash(dict1), vaDictionaryGetHash(dict2))) {
+        return false;
+    }
+    while(true) {
+        while(xEntry1 < used1 && vaDictionaryGetiKey(dict1, xEntry1) == vaValueNull) {
+            xEntry1++;
+        }
+        while(xEntry2 < used2 && vaDictionaryGetiKey(dict2, xEntry2) == vaValueNull) {
+            xEntry2++;
+        }
+        if(xEntry1 == used1 || xEntry2 == used2) {
+            return xEntry1 == used1 && xEntry2 == used2;
+        }
+        key1 = vaDictionaryGetiKey(dict1, xEntry1);
+        key2 = vaDictionaryGetiKey(dict2, xEntry2);
+        if(vaDictionaryGetiEntryHash(dict1, xEntry1) !=
+                    vaDictionaryGetiEntryHash(dict2, xEntry2) ||
+                !vaValuesEqual(key1, key2) ||
+                !vaValuesEqual(vaDictionaryGetiValue(dict1, xEntry1),
+                    vaDictionaryGetiValue(dict2, xEntry2))) {
             return false;
         }
-        dictEntry1 = vaDictEntryGetNextDictionaryDictEntry(dictEntry1);
-        dictEntry2 = vaDictEntryGetNextDictionaryDictEntry(dictEntry2);
+        xEntry1++;
+        xEntry2++;
+    }
+    return false; // Dummy return
+}
+
+// Hash the dictionary.  Like equality, this depends on the order of entries.  The hash is
+// cached until the dictionary changes, unless a value in it is a dictionary, which could
+// change without clearing this one's hash.
+uint32 vaDictionaryHash(
+    vaDictionary dictionary)
+{
+    uint32 hash = vaDictionaryGetHash(dictionary);
+    bool stable = true;
+    uint32 xEntry;
+    vaValue value;
+
+    if(hash != 0) {
+        return hash;
+    }
+    hash = vaDictionaryGetNumEntries(dictionary);
+    vaForeachDictionaryEntry(dictionary, xEntry) {
+        value = vaDictionaryGetiValue(dictionary, xEntry);
+        hash = utHashValues(hash, vaDictionaryGetiEntryHash(dictionary, xEntry));
+        hash = utHashValues(hash, vaValueHash(value));
+        stable = stable && vaValueHashStable(value);
+    } vaEndDictionaryEntry;
+    if(hash == 0) {
+        hash = 1;
+    }
+    if(stable) {
+        vaDictionarySetHash(dictionary, hash);
+    }
+    return hash;
+}
+
+// Find the slot holding the key.  If the key is not there, return the slot where it should
+// be inserted, which is the first deleted slot passed, or else the empty slot that ended
+// the probe.
+static uint32 findSlot(
+    vaDictionary dictionary,
+    vaValue key,
+    uint32 hash,
+    bool *found)
+{
+    uint32 mask = vaDictionaryGetNumSlot(dictionary) - 1;
+    uint32 xSlot = hash & mask;
+    uint32 perturb = hash;
+    uint32 freeSlot = VA_DELETED_SLOT;
+    uint32 position;
+
+    while(true) {
+        position = vaDictionaryGetiSlot(dictionary, xSlot);
+        if(position == VA_EMPTY_SLOT) {
+            *found = false;
+            return freeSlot != VA_DELETED_SLOT? freeSlot : xSlot;
+        }
+        if(position == VA_DELETED_SLOT) {
+            if(freeSlot == VA_DELETED_SLOT) {
+                freeSlot = xSlot;
+            }
+        } else if(vaDictionaryGetiEntryHash(dictionary, position - 1) == hash &&
+                vaValuesEqual(vaDictionaryGetiKey(dictionary, position - 1), key)) {
+            *found = true;
+            return xSlot;
+        }
+        perturb >>= 5;
+        xSlot = (5*xSlot + 1 + perturb) & mask;
+    }
+    return 0; // Dummy return
+}
+
+// Put an entry position in the first empty slot for its hash.  The table must not already
+// contain the key.
+static void insertPosition(
+    vaDictionary dictionary,
+    uint32 hash,
+    uint32 position)
+{
+    uint32 mask = vaDictionaryGetNumSlot(dictionary) - 1;
+    uint32 xSlot = hash & mask;
+    uint32 perturb = hash;
+
+    while(vaDictionaryGetiSlot(dictionary, xSlot) != VA_EMPTY_SLOT) {
+        perturb >>= 5;
+        xSlot = (5*xSlot + 1 + perturb) & mask;
+    }
+    vaDictionarySetiSlot(dictionary, xSlot, position + 1);
+}
+
+// Squeeze deleted entries out, and rebuild the slot table with numSlots slots, which must
+// be a power of 2.
+static void resizeDictionary(
+    vaDictionary dictionary,
+    uint32 numSlots)
+{
+    uint32 usedEntries = vaDictionaryGetUsedEntries(dictionary);
+    uint32 usableEntries = findUsableEntries(numSlots);
+    uint32 xFrom, xTo = 0, xSlot;
+    vaValue key;
+
+    for(xFrom = 0; xFrom < usedEntries; xFrom++) {
+        key = vaDictionaryGetiKey(dictionary, xFrom);
+        if(key != vaValueNull) {
+            if(xTo != xFrom) {
+                vaDictionarySetiEntryHash(dictionary, xTo,
+                    vaDictionaryGetiEntryHash(dictionary, xFrom));
+                vaDictionarySetiKey(dictionary, xTo, key);
+                vaDictionarySetiValue(dictionary, xTo, vaDictionaryGetiValue(dictionary, xFrom));
+            }
+            xTo++;
+        }
+    }
+    vaDictionarySetUsedEntries(dictionary, xTo);
+    vaDictionaryResizeEntryHashs(dictionary, usableEntries);
+    vaDictionaryResizeKeys(dictionary, usableEntries);
+    vaDictionaryResizeValues(dictionary, usableEntries);
+    vaDictionaryResizeSlots(dictionary, numSlots);
+    for(xSlot = 0; xSlot < numSlots; xSlot++) {
+        vaDictionarySetiSlot(dictionary, xSlot, VA_EMPTY_SLOT);
+    }
+    for(xFrom = 0; xFrom < xTo; xFrom++) {
+        insertPosition(dictionary, vaDictionaryGetiEntryHash(dictionary, xFrom), xFrom);
     }
-    return dictEntry1 == dictEntry2;
 }
 
 // Create a new empty dictionary.
@@ -33,22 +184,95 @@ vaDictionary vaDictionaryCreate(void)
 {
     vaDictionary dictionary = vaDictionaryAlloc();
 
-    // Initialize entry hash table
     vaDictionarySetNumEntries(dictionary, 0);
-    vaDictionaryResizeEntrys(dictionary, 42);
+    vaDictionarySetUsedEntries(dictionary, 0);
+    resizeDictionary(dictionary, VA_MIN_SLOTS);
     return dictionary;
 }
 
-// Insert a value into the dictionary.
+// Make room for numEntries entries, so that inserting them will not resize the table.
+void vaDictionaryReserve(
+    vaDictionary dictionary,
+    uint32 numEntries)
+{
+    uint32 numSlots = VA_MIN_SLOTS;
+
+    while(findUsableEntries(numSlots) < numEntries) {
+        numSlots <<= 1;
+    }
+    if(numSlots > vaDictionaryGetNumSlot(dictionary)) {
+        resizeDictionary(dictionary, numSlots);
+    }
+}
+
+// Insert a value into the dictionary.  If the key is already there, its value is replaced,
+// and it keeps its place in the order.
 void vaDictionaryInsertValue(
     vaDictionary dictionary,
     vaValue key,
     vaValue value)
 {
-    vaDictEntry dictEntry = vaDictEntryAlloc();
+    uint32 hash = vaValueHash(key);
+    uint32 numSlots, position, xSlot;
+    bool found;
 
-    vaDictEntrySetKey(dictEntry, key);
-    vaDictEntrySetValue(dictEntry, value);
-    vaDictionaryAppendDictEntry(dictionary, dictEntry);
+    vaDictionarySetHash(dictionary, 0);
+    xSlot = findSlot(dictionary, key, hash, &found);
+    if(found) {
+        position = vaDictionaryGetiSlot(dictionary, xSlot) - 1;
+        vaDictionarySetiValue(dictionary, position, value);
+        return;
+    }
+    position = vaDictionaryGetUsedEntries(dictionary);
+    if(position == vaDictionaryGetNumKey(dictionary)) {
+        // Out of entries.  Leave room to double the number of live entries.
+        numSlots = VA_MIN_SLOTS;
+        while(findUsableEntries(numSlots) <= vaDictionaryGetNumEntries(dictionary) << 1) {
+            numSlots <<= 1;
+        }
+        resizeDictionary(dictionary, numSlots);
+        xSlot = findSlot(dictionary, key, hash, &found);
+        position = vaDictionaryGetUsedEntries(dictionary);
+    }
+    vaDictionarySetiSlot(dictionary, xSlot, position + 1);
+    vaDictionarySetiEntryHash(dictionary, position, hash);
+    vaDictionarySetiKey(dictionary, position, key);
+    vaDictionarySetiValue(dictionary, position, value);
+    vaDictionarySetUsedEntries(dictionary, position + 1);
+    vaDictionarySetNumEntries(dictionary, vaDictionaryGetNumEntries(dictionary) + 1);
+}
+
+// Find the value for the key.  Return vaValueNull if the key is not in the dictionary.
+vaValue vaDictionaryFindValue(
+    vaDictionary dictionary,
+    vaValue key)
+{
+    bool found;
+    uint32 xSlot = findSlot(dictionary, key, vaValueHash(key), &found);
+
+    if(!found) {
+        return vaValueNull;
+    }
+    return vaDictionaryGetiValue(dictionary, vaDictionaryGetiSlot(dictionary, xSlot) - 1);
 }
 
+// Remove the key and its value from the dictionary.  Return false if the key is not there.
+bool vaDictionaryRemoveValue(
+    vaDictionary dictionary,
+    vaValue key)
+{
+    bool found;
+    uint32 xSlot = findSlot(dictionary, key, vaValueHash(key), &found);
+    uint32 position;
+
+    if(!found) {
+        return false;
+    }
+    position = vaDictionaryGetiSlot(dictionary, xSlot) - 1;
+    vaDictionarySetHash(dictionary, 0);
+    vaDictionarySetiSlot(dictionary, xSlot, VA_DELETED_SLOT);
+    vaDictionarySetiKey(dictionary, position, vaValueNull);
+    vaDictionarySetiValue(dictionary, position, vaValueNull);
+    vaDictionarySetNumEntries(dictionary, vaDictionaryGetNumEntries(dictionary) - 1);
+    return true;
+}
@@ -0,0 +1,478 @@
+/* Floating point formatting.  Decimal text always reads back to the same bits, and is
+   nearly always the shortest that does, found with Florian Loitsch's Grisu2 algorithm, which
+   needs only 64-bit integer arithmetic and a table of cached powers of ten.  Grisu2 works
+   in a slightly narrowed interval, so a small fraction of values, under 0.1%, get one digit
+   more than needed.  Hex text is exact, for vaValue2PreciseString.
+   Everything is written straight into the caller's buffer, which must hold at least
+   VA_MAX_FLOAT_TEXT bytes. */
+
+#include "value.h"
+
+// A floating point number with a 64-bit significand: f*2^e.
+typedef struct {
+    uint64 f;
+    int32 e;
+} vaDiyFp;
+
+// Normalized powers of ten from 10^-348 to 10^340, in steps of 8.
+static const uint64 vaCachedPowerSignificands[] = {
+    0xfa8fd5a0081c0288llu, 0xbaaee17fa23ebf76llu, 0x8b16fb203055ac76llu,
+    0xcf42894a5dce35eallu, 0x9a6bb0aa55653b2dllu, 0xe61acf033d1a45dfllu,
+    0xab70fe17c79ac6callu, 0xff77b1fcbebcdc4fllu, 0xbe5691ef416bd60cllu,
+    0x8dd01fad907ffc3cllu, 0xd3515c2831559a83llu, 0x9d71ac8fada6c9b5llu,
+    0xea9c227723ee8bcbllu, 0xaecc49914078536dllu, 0x823c12795db6ce57llu,
+    0xc21094364dfb5637llu, 0x9096ea6f3848984fllu, 0xd77485cb25823ac7llu,
+    0xa086cfcd97bf97f4llu, 0xef340a98172aace5llu, 0xb23867fb2a35b28ellu,
+    0x84c8d4dfd2c63f3bllu, 0xc5dd44271ad3cdballu, 0x936b9fcebb25c996llu,
+    0xdbac6c247d62a584llu, 0xa3ab66580d5fdaf6llu, 0xf3e2f893dec3f126llu,
+    0xb5b5ada8aaff80b8llu, 0x87625f056c7c4a8bllu, 0xc9bcff6034c13053llu,
+    0x964e858c91ba2655llu, 0xdff9772470297ebdllu, 0xa6dfbd9fb8e5b88fllu,
+    0xf8a95fcf88747d94llu, 0xb94470938fa89bcfllu, 0x8a08f0f8bf0f156bllu,
+    0xcdb02555653131b6llu, 0x993fe2c6d07b7facllu, 0xe45c10c42a2b3b06llu,
+    0xaa242499697392d3llu, 0xfd87b5f28300ca0ellu, 0xbce5086492111aebllu,
+    0x8cbccc096f5088ccllu, 0xd1b71758e219652cllu, 0x9c40000000000000llu,
+    0xe8d4a51000000000llu, 0xad78ebc5ac620000llu, 0x813f3978f8940984llu,
+    0xc097ce7bc90715b3llu, 0x8f7e32ce7bea5c70llu, 0xd5d238a4abe98068llu,
+    0x9f4f2726179a2245llu, 0xed63a231d4c4fb27llu, 0xb0de65388cc8ada8llu,
+    0x83c7088e1aab65dbllu, 0xc45d1df942711d9allu, 0x924d692ca61be758llu,
+    0xda01ee641a708deallu, 0xa26da3999aef774allu, 0xf209787bb47d6b85llu,
+    0xb454e4a179dd1877llu, 0x865b86925b9bc5c2llu, 0xc83553c5c8965d3dllu,
+    0x952ab45cfa97a0b3llu, 0xde469fbd99a05fe3llu, 0xa59bc234db398c25llu,
+    0xf6c69a72a3989f5cllu, 0xb7dcbf5354e9becellu, 0x88fcf317f22241e2llu,
+    0xcc20ce9bd35c78a5llu, 0x98165af37b2153dfllu, 0xe2a0b5dc971f303allu,
+    0xa8d9d1535ce3b396llu, 0xfb9b7cd9a4a7443cllu, 0xbb764c4ca7a44410llu,
+    0x8bab8eefb6409c1allu, 0xd01fef10a657842cllu, 0x9b10a4e5e9913129llu,
+    0xe7109bfba19c0c9dllu, 0xac2820d9623bf429llu, 0x80444b5e7aa7cf85llu,
+    0xbf21e44003acdd2dllu, 0x8e679c2f5e44ff8fllu, 0xd433179d9c8cb841llu,
+    0x9e19db92b4e31ba9llu, 0xeb96bf6ebadf77d9llu, 0xaf87023b9bf0ee6bllu
+};
+static const int16 vaCachedPowerExponents[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066
+};
+
+static const uint32 vaPowersOfTen[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+// Create a vaDiyFp.
+static inline vaDiyFp diyFpCreate(
+    uint64 f,
+    int32 e)
+{
+    vaDiyFp x;
+
+    x.f = f;
+    x.e = e;
+    return x;
+}
+
+// Shift the significand left until its top bit is set.
+static inline vaDiyFp normalize(
+    vaDiyFp x)
+{
+    int32 shift = __builtin_clzll(x.f);
+
+    return diyFpCreate(x.f << shift, x.e - shift);
+}
+
+// Multiply, keeping the rounded upper 64 bits of the product.
+static vaDiyFp multiply(
+    vaDiyFp x,
+    vaDiyFp y)
+{
+    uint64 a = x.f >> 32, b = x.f & 0xffffffffu;
+    uint64 c = y.f >> 32, d = y.f & 0xffffffffu;
+    uint64 ac = a*c, bc = b*c, ad = a*d, bd = b*d;
+    uint64 middle = (bd >> 32) + (ad & 0xffffffffu) + (bc & 0xffffffffu) + (1u << 31);
+
+    return diyFpCreate(ac + (ad >> 32) + (bc >> 32) + (middle >> 32), x.e + y.e + 64);
+}
+
+// Find the cached power of ten that brings a number with binary exponent e into the range
+// Grisu needs, and return -K, where the power is 10^-K.
+static vaDiyFp findCachedPower(
+    int32 e,
+    int32 *K)
+{
+    double dk = (-61 - e)*0.30102999566398114 + 347;
+    int32 k = (int32)dk;
+    uint32 index;
+
+    if(dk - k > 0.0) {
+        k++;
+    }
+    index = (uint32)((k >> 3) + 1);
+    *K = -(-348 + (int32)(index << 3));
+    return diyFpCreate(vaCachedPowerSignificands[index], vaCachedPowerExponents[index]);
+}
+
+// Count the decimal digits of a 32-bit integer.
+static inline uint32 countDigits(
+    uint32 value)
+{
+    uint32 numDigits = 1;
+
+    while(numDigits < 10 && value >= vaPowersOfTen[numDigits]) {
+        numDigits++;
+    }
+    return numDigits;
+}
+
+// Move the last digit towards the exact value, while staying inside the rounding interval.
+static void roundDigits(
+    char *digits,
+    uint32 numDigits,
+    uint64 delta,
+    uint64 rest,
+    uint64 tenKappa,
+    uint64 distance)
+{
+    while(rest < distance && delta - rest >= tenKappa &&
+            (rest + tenKappa < distance || distance - rest > rest + tenKappa - distance)) {
+        digits[numDigits - 1]--;
+        rest += tenKappa;
+    }
+}
+
+// Generate the fewest digits of W that fall in the interval from high - delta to high.
+// The value is digits*10^K.
+static uint32 generateDigits(
+    vaDiyFp W,
+    vaDiyFp high,
+    uint64 delta,
+    char *digits,
+    int32 *K)
+{
+    vaDiyFp one = diyFpCreate(1llu << -high.e, high.e);
+    uint64 distance = high.f - W.f;
+    uint32 p1 = (uint32)(high.f >> -one.e);
+    uint64 p2 = high.f & (one.f - 1);
+    int32 kappa = countDigits(p1);
+    uint32 numDigits = 0;
+    uint32 digit;
+    uint64 rest;
+
+    while(kappa > 0) {
+        digit = p1/vaPowersOfTen[kappa - 1];
+        p1 %= vaPowersOfTen[kappa - 1];
+        if(digit != 0 || numDigits != 0) {
+            digits[numDigits++] = '0' + digit;
+        }
+        kappa--;
+        rest = ((uint64)p1 << -one.e) + p2;
+        if(rest <= delta) {
+            *K += kappa;
+            roundDigits(digits, numDigits, delta, rest,
+                (uint64)vaPowersOfTen[kappa] << -one.e, distance);
+            return numDigits;
+        }
+    }
+    while(true) {
+        p2 *= 10;
+        delta *= 10;
+        distance *= 10;
+        digit = (uint32)(p2 >> -one.e);
+        if(digit != 0 || numDigits != 0) {
+            digits[numDigits++] = '0' + digit;
+        }
+        p2 &= one.f - 1;
+        kappa--;
+        if(p2 < delta) {
+            *K += kappa;
+            roundDigits(digits, numDigits, delta, p2, one.f, distance);
+            return numDigits;
+        }
+    }
+    return 0; // Dummy return
+}
+
+// Find short digits of the positive value f*2^e that read back to it, nearly always the
+// shortest, where the significand has numBits bits including the hidden bit.  The value is
+// digits*10^K.
+static uint32 grisu2(
+    uint64 f,
+    int32 e,
+    uint32 numBits,
+    char *digits,
+    int32 *K)
+{
+    vaDiyFp v = diyFpCreate(f, e);
+    vaDiyFp high = normalize(diyFpCreate((f << 1) + 1, e - 1));
+    vaDiyFp low, power, W;
+
+    // The gap below a power of two is half the gap above it.
+    if(f == 1llu << (numBits - 1)) {
+        low = diyFpCreate((f << 2) - 1, e - 2);
+    } else {
+        low = diyFpCreate((f << 1) - 1, e - 1);
+    }
+    low.f <<= low.e - high.e;
+    low.e = high.e;
+    power = findCachedPower(high.e, K);
+    W = multiply(normalize(v), power);
+    high = multiply(high, power);
+    low = multiply(low, power);
+    // Shrink the interval by one unit on each side, to allow for rounding errors.
+    low.f++;
+    high.f--;
+    return generateDigits(W, high, high.f - low.f, digits, K);
+}
+
+// Write a decimal integer, and return the end of the text.
+static char *writeInt(
+    char *p,
+    int32 value)
+{
+    char digits[12];
+    uint32 numDigits = 0;
+    uint32 magnitude = value < 0? -(uint32)value : (uint32)value;
+
+    if(value < 0) {
+        *p++ = '-';
+    }
+    do {
+        digits[numDigits++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while(magnitude != 0);
+    while(numDigits != 0) {
+        *p++ = digits[--numDigits];
+    }
+    return p;
+}
+
+// Lay out the digits, which are at p, with decimal exponent K.  The text always has a '.' or
+// an 'e', so that it reads back as a float rather than an integer.
+static char *layOutDigits(
+    char *p,
+    uint32 numDigits,
+    int32 K)
+{
+    int32 length = numDigits;
+    int32 point = length + K; // Position of the decimal point
+
+    if(K >= 0 && point <= 21) {
+        // An integer: 1234e7 -> 12340000000.0
+        memset(p + length, '0', K);
+        p += point;
+        *p++ = '.';
+        *p++ = '0';
+    } else if(point > 0 && point <= 21) {
+        // 1234e-2 -> 12.34
+        memmove(p + point + 1, p + point, length - point);
+        p[point] = '.';
+        p += length + 1;
+    } else if(point > -6 && point <= 0) {
+        // 1234e-6 -> 0.001234
+        memmove(p + 2 - point, p, length);
+        p[0] = '0';
+        p[1] = '.';
+        memset(p + 2, '0', -point);
+        p += length + 2 - point;
+    } else if(length == 1) {
+        // 1e30
+        p[1] = 'e';
+        p = writeInt(p + 2, point - 1);
+    } else {
+        // 1234e30 -> 1.234e33
+        memmove(p + 2, p + 1, length - 1);
+        p[1] = '.';
+        p[length + 1] = 'e';
+        p = writeInt(p + length + 2, point - 1);
+    }
+    return p;
+}
+
+// Write infinities, NaNs and zeros, which have no digits to generate.  For other values,
+// write just the sign, and return NULL.
+static char *writeSpecial(
+    char *p,
+    bool negative,
+    bool isInfinite,
+    bool isNan,
+    bool isZero)
+{
+    if(isNan) {
+        strcpy(p, "nan");
+        return p + 3;
+    }
+    if(negative) {
+        *p++ = '-';
+    }
+    if(isInfinite) {
+        strcpy(p, "inf");
+        return p + 3;
+    }
+    if(isZero) {
+        strcpy(p, "0.0");
+        return p + 3;
+    }
+    return NULL;
+}
+
+// Write decimal text that reads back to the same double, nearly always the shortest.
+// Return its length.
+uint32 vaFormatDouble(
+    double value,
+    char *buffer)
+{
+    uint64 bits, f;
+    uint32 biasedExponent, numDigits;
+    int32 e, K;
+    char *p;
+
+    memcpy(&bits, &value, sizeof(double));
+    f = bits & 0xfffffffffffffllu;
+    biasedExponent = (bits >> 52) & 0x7ff;
+    p = writeSpecial(buffer, bits >> 63, biasedExponent == 0x7ff && f == 0,
+        biasedExponent == 0x7ff && f != 0, biasedExponent == 0 && f == 0);
+    if(p == NULL) {
+        p = buffer + (bits >> 63);
+        if(biasedExponent == 0) {
+            e = 1 - 1075;
+        } else {
+            f |= 1llu << 52;
+            e = (int32)biasedExponent - 1075;
+        }
+        numDigits = grisu2(f, e, 53, p, &K);
+        p = layOutDigits(p, numDigits, K);
+    }
+    *p = '\0';
+    return p - buffer;
+}
+
+// Write decimal text that reads back to the same float, nearly always the shortest.
+// Return its length.
+uint32 vaFormatFloat(
+    float value,
+    char *buffer)
+{
+    uint32 bits, f, biasedExponent, numDigits;
+    int32 e, K;
+    char *p;
+
+    memcpy(&bits, &value, sizeof(float));
+    f = bits & 0x7fffffu;
+    biasedExponent = (bits >> 23) & 0xff;
+    p = writeSpecial(buffer, bits >> 31, biasedExponent == 0xff && f == 0,
+        biasedExponent == 0xff && f != 0, biasedExponent == 0 && f == 0);
+    if(p == NULL) {
+        p = buffer + (bits >> 31);
+        if(biasedExponent == 0) {
+            e = 1 - 150;
+        } else {
+            f |= 1u << 23;
+            e = (int32)biasedExponent - 150;
+        }
+        numDigits = grisu2(f, e, 24, p, &K);
+        p = layOutDigits(p, numDigits, K);
+    }
+    *p = '\0';
+    return p - buffer;
+}
+
+// Write the exact hex text of a value with a fraction of numNibbles hex digits, such as
+// 0x1.8p-3.  Subnormals are normalized.
+static char *writeHex(
+    char *p,
+    uint64 fraction,
+    uint32 numNibbles,
+    int32 exponent)
+{
+    uint32 numDigits = numNibbles;
+
+    *p++ = '0';
+    *p++ = 'x';
+    *p++ = '1';
+    *p++ = '.';
+    while(numDigits > 1 && (fraction & 0xf) == 0) {
+        fraction >>= 4;
+        numDigits--;
+    }
+    while(numDigits != 0) {
+        numDigits--;
+        *p++ = toHex((fraction >> (numDigits << 2)) & 0xf);
+    }
+    *p++ = 'p';
+    return writeInt(p, exponent);
+}
+
+// Write the exact hex text of a double.  Return its length.
+uint32 vaFormatHexDouble(
+    double value,
+    char *buffer)
+{
+    uint64 bits, fraction;
+    int32 biasedExponent, exponent;
+    char *p;
+
+    memcpy(&bits, &value, sizeof(double));
+    fraction = bits & 0xfffffffffffffllu;
+    biasedExponent = (bits >> 52) & 0x7ff;
+    p = writeSpecial(buffer, bits >> 63, biasedExponent == 0x7ff && fraction == 0,
+        biasedExponent == 0x7ff && fraction != 0, false);
+    if(p == NULL) {
+        p = buffer + (bits >> 63);
+        if(biasedExponent == 0 && fraction == 0) {
+            strcpy(p, "0x0.0p0");
+            p += 7;
+        } else {
+            exponent = biasedExponent - 1023;
+            if(biasedExponent == 0) {
+                exponent = -1022;
+                while(!(fraction & (1llu << 52))) {
+                    fraction <<= 1;
+                    exponent--;
+                }
+                fraction &= 0xfffffffffffffllu;
+            }
+            p = writeHex(p, fraction, 13, exponent);
+        }
+    }
+    *p = '\0';
+    return p - buffer;
+}
+
+// Write the exact hex text of a float.  Return its length.
+uint32 vaFormatHexFloat(
+    float value,
+    char *buffer)
+{
+    uint32 bits, fraction;
+    int32 biasedExponent, exponent;
+    char *p;
+
+    memcpy(&bits, &value, sizeof(float));
+    fraction = bits & 0x7fffffu;
+    biasedExponent = (bits >> 23) & 0xff;
+    p = writeSpecial(buffer, bits >> 31, biasedExponent == 0xff && fraction == 0,
+        biasedExponent == 0xff && fraction != 0, false);
+    if(p == NULL) {
+        p = buffer + (bits >> 31);
+        if(biasedExponent == 0 && fraction == 0) {
+            strcpy(p, "0x0.0p0");
+            p += 7;
+        } else {
+            exponent = biasedExponent - 127;
+            if(biasedExponent == 0) {
+                exponent = -126;
+                while(!(fraction & (1u << 23))) {
+                    fraction <<= 1;
+                    exponent--;
+                }
+                fraction &= 0x7fffffu;
+            }
+            // Shift the 23 fraction bits to fill 6 hex digits.
+            p = writeHex(p, (uint64)fraction << 1, 6, exponent);
+        }
+    }
+    *p = '\0';
+    return p - buffer;
+}
@@ -0,0 +1,169 @@
+/* 64-bit content hashes, using the XXH64 algorithm, so they match other XXH64
+   implementations.  Bytes can be added in pieces of any size, such as the chunks passed to
+   a hash sink as a value is encoded, and the result is the same as hashing them at once. */
+
+#include "value.h"
+
+#define VA_PRIME1 0x9E3779B185EBCA87llu
+#define VA_PRIME2 0xC2B2AE3D27D4EB4Fllu
+#define VA_PRIME3 0x165667B19E3779F9llu
+#define VA_PRIME4 0x85EBCA77C2B2AE63llu
+#define VA_PRIME5 0x27D4EB2F165667C5llu
+
+// Rotate left.
+static inline uint64 rotateLeft(
+    uint64 value,
+    uint32 bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+// Read a little-endian 64-bit word.
+static inline uint64 readWord(
+    uint8 *bytes)
+{
+    uint64 word;
+
+    memcpy(&word, bytes, sizeof(uint64));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return word;
+}
+
+// Read a little-endian 32-bit word.
+static inline uint32 readHalfWord(
+    uint8 *bytes)
+{
+    uint32 word;
+
+    memcpy(&word, bytes, sizeof(uint32));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap32(word);
+#endif
+    return word;
+}
+
+// Mix a word into an accumulator.
+static inline uint64 mixWord(
+    uint64 accumulator,
+    uint64 word)
+{
+    return rotateLeft(accumulator + word*VA_PRIME2, 31)*VA_PRIME1;
+}
+
+// Merge an accumulator into the hash.
+static inline uint64 mergeAccumulator(
+    uint64 hash,
+    uint64 accumulator)
+{
+    return (hash ^ mixWord(0, accumulator))*VA_PRIME1 + VA_PRIME4;
+}
+
+// Mix a 32 byte stripe into the accumulators.
+static inline void mixStripe(
+    vaHasher *hasher,
+    uint8 *bytes)
+{
+    hasher->accumulators[0] = mixWord(hasher->accumulators[0], readWord(bytes));
+    hasher->accumulators[1] = mixWord(hasher->accumulators[1], readWord(bytes + 8));
+    hasher->accumulators[2] = mixWord(hasher->accumulators[2], readWord(bytes + 16));
+    hasher->accumulators[3] = mixWord(hasher->accumulators[3], readWord(bytes + 24));
+}
+
+// Start a hash.
+void vaHasherStart(
+    vaHasher *hasher,
+    uint64 seed)
+{
+    hasher->accumulators[0] = seed + VA_PRIME1 + VA_PRIME2;
+    hasher->accumulators[1] = seed + VA_PRIME2;
+    hasher->accumulators[2] = seed;
+    hasher->accumulators[3] = seed - VA_PRIME1;
+    hasher->seed = seed;
+    hasher->length = 0;
+    hasher->used = 0;
+}
+
+// Add bytes to the hash.  Whole stripes are mixed in place, and only a partial stripe is
+// copied.
+void vaHasherAdd(
+    vaHasher *hasher,
+    uint8 *bytes,
+    uint64 length)
+{
+    uint64 needed;
+
+    hasher->length += length;
+    if(hasher->used != 0) {
+        needed = VA_HASH_STRIPE - hasher->used;
+        if(length < needed) {
+            memcpy(hasher->stripe + hasher->used, bytes, length);
+            hasher->used += length;
+            return;
+        }
+        memcpy(hasher->stripe + hasher->used, bytes, needed);
+        mixStripe(hasher, hasher->stripe);
+        bytes += needed;
+        length -= needed;
+        hasher->used = 0;
+    }
+    while(length >= VA_HASH_STRIPE) {
+        mixStripe(hasher, bytes);
+        bytes += VA_HASH_STRIPE;
+        length -= VA_HASH_STRIPE;
+    }
+    memcpy(hasher->stripe, bytes, length);
+    hasher->used = length;
+}
+
+// Return the hash of the bytes added so far.  More bytes can still be added.
+uint64 vaHasherFinish(
+    vaHasher *hasher)
+{
+    uint64 *accumulators = hasher->accumulators;
+    uint8 *bytes = hasher->stripe;
+    uint32 length = hasher->used;
+    uint64 hash;
+
+    if(hasher->length >= VA_HASH_STRIPE) {
+        hash = rotateLeft(accumulators[0], 1) + rotateLeft(accumulators[1], 7) +
+            rotateLeft(accumulators[2], 12) + rotateLeft(accumulators[3], 18);
+        hash = mergeAccumulator(hash, accumulators[0]);
+        hash = mergeAccumulator(hash, accumulators[1]);
+        hash = mergeAccumulator(hash, accumulators[2]);
+        hash = mergeAccumulator(hash, accumulators[3]);
+    } else {
+        hash = hasher->seed + VA_PRIME5;
+    }
+    hash += hasher->length;
+    for(; length >= 8; length -= 8, bytes += 8) {
+        hash = rotateLeft(hash ^ mixWord(0, readWord(bytes)), 27)*VA_PRIME1 + VA_PRIME4;
+    }
+    if(length >= 4) {
+        hash = rotateLeft(hash ^ (readHalfWord(bytes)*VA_PRIME1), 23)*VA_PRIME2 + VA_PRIME3;
+        length -= 4;
+        bytes += 4;
+    }
+    while(length--) {
+        hash = rotateLeft(hash ^ (*bytes++*VA_PRIME5), 11)*VA_PRIME1;
+    }
+    hash ^= hash >> 33;
+    hash *= VA_PRIME2;
+    hash ^= hash >> 29;
+    hash *= VA_PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+// Hash the bytes at once.
+uint64 vaHash64(
+    uint8 *bytes,
+    uint64 length)
+{
+    vaHasher hasher;
+
+    vaHasherStart(&hasher, 0);
+    vaHasherAdd(&hasher, bytes, length);
+    return vaHasherFinish(&hasher);
+}
@@ -10,7 +10,11 @@ bool vaListsEqual(
     uint32 numValues = vaListGetUsedValue(list1);
     uint32 xValue;
 
-    if(vaListGetUsedValue(list2) != numValues) {
+    if(list1 == list2) {
+        return true;
+    }
+    if(vaListGetUsedValue(list2) != numValues ||
+            vaHashesDiffer(vaListGetHash(list1), vaListGetHash(list2))) {
         return false;
     }
     for(xValue = 0; xValue < numValues; xValue++) {
@@ -22,3 +26,29 @@ bool vaListsEqual(
     }
     return true;
 }
+
+// Hash the values of the list, in order.  The hash is cached on the list, unless the list
+// holds a dictionary, which could change.
+uint32 vaListHash(
+    vaList list)
+{
+    uint32 hash = vaListGetHash(list);
+    bool stable = true;
+    vaValue value;
+
+    if(hash != 0) {
+        return hash;
+    }
+    hash = vaListGetUsedValue(list);
+    vaForeachListValue(list, value) {
+        hash = utHashValues(hash, vaValueHash(value));
+        stable = stable && vaValueHashStable(value);
+    } vaEndListValue;
+    if(hash == 0) {
+        hash = 1;
+    }
+    if(stable) {
+        vaListSetHash(list, hash);
+    }
+    return hash;
+}
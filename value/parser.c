@@ -0,0 +1,1075 @@
+/* Text parser for values.  Text is parsed in two passes.  The first checks the syntax, and
+   counts the elements of each tuple, list and dictionary, without creating any values.  The
+   second builds the value, allocating each container at its final size.  Syntax errors are
+   all found in the first pass, so they are returned with nothing to clean up.
+
+   Most of a large text is usually in strings, which are scanned 16 bytes at a time for
+   quotes, backslashes and zeros where SSE2 is available.  Decimal numbers with up to 19
+   digits and small exponents are converted exactly without calling strtod.
+
+   When more than one parse thread is set, a large top-level tuple, list or dictionary is
+   split at top-level commas into groups of elements, and each group is checked and counted
+   on its own thread.  Values are DataDraw objects, which are allocated on one thread, so the
+   second pass builds the groups in order on the calling thread.  Text with errors is parsed
+   again sequentially, to report the first error. */
+
+#include <stdlib.h>
+#include <ctype.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "value.h"
+
+#define VA_MAX_PARSE_DEPTH 10000
+#define VA_MAX_EXACT_MANTISSA (1llu << 53)
+#define VA_MAX_EXACT_POWER 22
+#define VA_MAX_PARSE_THREADS 64
+#define VA_MIN_PARALLEL_BYTES (1 << 20)
+
+// The state of one parse.  Each parse has its own, so text can be parsed on several threads,
+// as long as creating values is serialized.
+typedef struct {
+    uchar *buffer; // Text of the string or ident being built
+    uint64 size, pos;
+    uint32 *counts; // Element counts of containers, in the order they open
+    uint64 countsSize, numCounts, countPos;
+    uint32 depth;
+    char *message; // Set on a syntax error
+    uchar *errorPos;
+} vaParser;
+
+// A group of the top-level container's elements, checked on its own thread.
+typedef struct {
+    vaParser parser;
+    uchar *start, *end; // The end is the comma or bracket after the last element
+    uint64 numElements;
+    bool isDictionary;
+    bool failed;
+    bool threadStarted;
+    pthread_t thread;
+} vaParseGroup;
+
+// A number read from the text.
+typedef struct {
+    vaType type; // VA_POSINT, VA_NEGINT, VA_OBJECT, VA_FLOAT or VA_DOUBLE
+    uint64 uintVal;
+    double doubleVal;
+} vaNumber;
+
+static uint32 vaParseThreads = 1;
+
+// Powers of ten that are exact in a double.
+static const double vaPowersOfTen[VA_MAX_EXACT_POWER + 1] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+    1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Record a syntax error, and return NULL.
+static uchar *syntaxError(
+    vaParser *parser,
+    uchar *p,
+    char *message)
+{
+    parser->message = message;
+    parser->errorPos = p;
+    return NULL;
+}
+
+// Skip white space.
+static inline uchar *skipSpace(
+    uchar *p)
+{
+    while(*p != '\0' && *p <= ' ') {
+        p++;
+    }
+    return p;
+}
+
+// Return true if the character can be part of an ident without an escape.  Non-ASCII
+// characters are allowed, as the writer does not escape them.
+static inline bool isIdentChar(
+    uchar c)
+{
+    return isalnum(c) || c == '_' || c >= 0x80;
+}
+
+// Return a pointer to the first quote, backslash or zero in the text.
+static inline uchar *findStringSpecial(
+    uchar *p)
+{
+#ifdef __SSE2__
+    __m128i quotes = _mm_set1_epi8('"');
+    __m128i backslashes = _mm_set1_epi8('\\');
+    __m128i zeros = _mm_setzero_si128();
+    __m128i bytes;
+    uint32 mask;
+
+    // Aligned loads never cross into the next page, so they can't fault past the zero.
+    while(((uintptr_t)p & 15) != 0) {
+        if(*p == '"' || *p == '\\' || *p == '\0') {
+            return p;
+        }
+        p++;
+    }
+    while(true) {
+        bytes = _mm_load_si128((__m128i *)p);
+        mask = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, quotes),
+            _mm_cmpeq_epi8(bytes, backslashes)), _mm_cmpeq_epi8(bytes, zeros)));
+        if(mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+#else
+    while(*p != '"' && *p != '\\' && *p != '\0') {
+        p++;
+    }
+    return p;
+#endif
+}
+
+// Resize a parser's scratch array.  Worker threads grow their parser's counts, so scratch
+// arrays use malloc rather than the ddutil allocator, which is not thread-safe.
+static void *resizeScratch(
+    void *array,
+    uint64 size)
+{
+    array = realloc(array, size);
+    if(array == NULL) {
+        utExit("Out of memory parsing value text");
+    }
+    return array;
+}
+
+// Make room for length more bytes in the parser's buffer.
+static inline void reserveBuffer(
+    vaParser *parser,
+    uint64 length)
+{
+    if(parser->pos + length > parser->size) {
+        parser->size = (parser->size << 1) + length;
+        parser->buffer = resizeScratch(parser->buffer, parser->size);
+    }
+}
+
+// Add bytes to the parser's buffer.
+static inline void addBytes(
+    vaParser *parser,
+    uchar *bytes,
+    uint64 length)
+{
+    reserveBuffer(parser, length);
+    memcpy(parser->buffer + parser->pos, bytes, length);
+    parser->pos += length;
+}
+
+// Add a byte to the parser's buffer.
+static inline void addByte(
+    vaParser *parser,
+    uchar c)
+{
+    reserveBuffer(parser, 1);
+    parser->buffer[parser->pos++] = c;
+}
+
+// Return the character an escape stands for.  Only \n, \r and \t are special.
+static inline uchar unescape(
+    uchar c)
+{
+    switch(c) {
+    case 'n': return '\n';
+    case 'r': return '\r';
+    case 't': return '\t';
+    default:
+        return c;
+    }
+}
+
+// Convert a hex character into a value.  If not a valid hex character, return 255.
+static inline uint8 fromHex(
+    uchar c)
+{
+    if(c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c |= 0x20;
+    if(c >= 'a' && c <= 'f') {
+        return 10 + c - 'a';
+    }
+    return 255;
+}
+
+// Read the hex digits of an integer or object reference.
+static uchar *readHex(
+    vaParser *parser,
+    uchar *p,
+    uint64 *value)
+{
+    uchar *start = p;
+    uint8 digit;
+
+    *value = 0;
+    while((digit = fromHex(*p)) < 16) {
+        if(p - start == 16) {
+            return syntaxError(parser, start, "Hex number too large");
+        }
+        *value = (*value << 4) | digit;
+        p++;
+    }
+    if(p == start) {
+        return syntaxError(parser, p, "Expected hex digits");
+    }
+    return p;
+}
+
+// Convert a decimal float exactly, when its digits fit in a double's mantissa and the power
+// of ten is exact.  Otherwise, leave it to strtod.  Return NULL on a syntax error.
+static uchar *readDecimalFloat(
+    vaParser *parser,
+    uchar *p,
+    double *value)
+{
+    uchar *start = p;
+    uint64 mantissa = 0;
+    uint32 numDigits = 0;
+    int32 exponent = 0, explicitExponent = 0;
+    bool truncated = false, negativeExponent;
+    char *tail;
+
+    for(; isdigit(*p); p++) {
+        if(numDigits < 19) {
+            mantissa = 10*mantissa + *p - '0';
+            numDigits += mantissa != 0;
+        } else {
+            truncated = true;
+            exponent++;
+        }
+    }
+    if(*p == '.') {
+        for(p++; isdigit(*p); p++) {
+            if(numDigits < 19) {
+                mantissa = 10*mantissa + *p - '0';
+                numDigits += mantissa != 0;
+                exponent--;
+            } else {
+                truncated = true;
+            }
+        }
+    }
+    if(*p == 'e' || *p == 'E') {
+        p++;
+        negativeExponent = *p == '-';
+        if(*p == '-' || *p == '+') {
+            p++;
+        }
+        if(!isdigit(*p)) {
+            return syntaxError(parser, p, "Expected exponent digits");
+        }
+        for(; isdigit(*p); p++) {
+            if(explicitExponent < 100000) {
+                explicitExponent = 10*explicitExponent + *p - '0';
+            }
+        }
+        exponent += negativeExponent? -explicitExponent : explicitExponent;
+    }
+    if(mantissa == 0 && !truncated) {
+        *value = 0.0;
+    } else if(!truncated && mantissa <= VA_MAX_EXACT_MANTISSA &&
+            exponent >= -VA_MAX_EXACT_POWER && exponent <= VA_MAX_EXACT_POWER) {
+        *value = exponent >= 0? (double)mantissa*vaPowersOfTen[exponent] :
+            (double)mantissa/vaPowersOfTen[-exponent];
+    } else {
+        *value = strtod((char *)start, &tail);
+    }
+    return p;
+}
+
+// Read an integer, float or double, with an optional sign.  Hex floats are read by strtod.
+static uchar *readNumber(
+    vaParser *parser,
+    uchar *p,
+    vaNumber *number)
+{
+    bool negate = false, overflow = false;
+    uchar *start, *q;
+    uint64 value = 0;
+    uint8 digit;
+    char *tail;
+
+    if(*p == '-' || *p == '+') {
+        negate = *p == '-';
+        p = skipSpace(p + 1);
+    }
+    start = p;
+    if(p[0] == '0' && p[1] == 'x') {
+        for(q = p + 2; fromHex(*q) < 16; q++);
+        if(*q == '.' || *q == 'p' || *q == 'P') {
+            number->doubleVal = strtod((char *)p, &tail);
+            p = (uchar *)tail;
+            if(p <= q) {
+                return syntaxError(parser, start, "Invalid hex float");
+            }
+        } else {
+            p = readHex(parser, p + 2, &number->uintVal);
+            number->type = negate? VA_NEGINT : VA_POSINT;
+            return p;
+        }
+    } else {
+        if(!isdigit(*p)) {
+            return syntaxError(parser, p, "Invalid number");
+        }
+        for(q = p; isdigit(*q); q++) {
+            digit = *q - '0';
+            if(value > (UINT64_MAX - digit)/10) {
+                overflow = true;
+            }
+            value = 10*value + digit;
+        }
+        if(*q != '.' && *q != 'e' && *q != 'E') {
+            if(overflow) {
+                return syntaxError(parser, start, "Integer too large");
+            }
+            number->uintVal = value;
+            number->type = negate? VA_NEGINT : VA_POSINT;
+            return q;
+        }
+        p = readDecimalFloat(parser, p, &number->doubleVal);
+        if(p == NULL) {
+            return NULL;
+        }
+    }
+    if(negate) {
+        number->doubleVal = -number->doubleVal;
+    }
+    number->type = (float)number->doubleVal == number->doubleVal? VA_FLOAT : VA_DOUBLE;
+    return p;
+}
+
+// Forward declaration for recursion.
+static uchar *scanValue(vaParser *parser, uchar *p);
+
+// Reserve the next container count, and return its position.
+static uint64 reserveCount(
+    vaParser *parser)
+{
+    if(parser->numCounts == parser->countsSize) {
+        parser->countsSize <<= 1;
+        parser->counts = resizeScratch(parser->counts, parser->countsSize*sizeof(uint32));
+    }
+    return parser->numCounts++;
+}
+
+// Enter a container, and check the nesting depth.
+static inline bool enterContainer(
+    vaParser *parser,
+    uchar *p)
+{
+    if(++parser->depth > VA_MAX_PARSE_DEPTH) {
+        syntaxError(parser, p, "Values nested too deeply");
+        return false;
+    }
+    return true;
+}
+
+// Record a container's element count, and leave it.
+static inline bool leaveContainer(
+    vaParser *parser,
+    uchar *p,
+    uint64 xCount,
+    uint64 count)
+{
+    if(count > UINT32_MAX) {
+        syntaxError(parser, p, "Too many elements");
+        return false;
+    }
+    parser->counts[xCount] = count;
+    parser->depth--;
+    return true;
+}
+
+// Check a tuple or list, after its opening bracket.
+static uchar *scanList(
+    vaParser *parser,
+    uchar *p,
+    uchar close)
+{
+    uint64 xCount = reserveCount(parser);
+    uint64 count = 0;
+
+    if(!enterContainer(parser, p)) {
+        return NULL;
+    }
+    p = skipSpace(p);
+    if(*p != close) {
+        while(true) {
+            p = scanValue(parser, p);
+            if(p == NULL) {
+                return NULL;
+            }
+            count++;
+            p = skipSpace(p);
+            if(*p == close) {
+                break;
+            }
+            if(*p != ',') {
+                return syntaxError(parser, p, close == ']'? "Expected , or ] in list" :
+                    "Expected , or ) in tuple");
+            }
+            p++;
+        }
+    }
+    if(!leaveContainer(parser, p, xCount, count)) {
+        return NULL;
+    }
+    return p + 1;
+}
+
+// Check a dictionary, after its opening <|.
+static uchar *scanDictionary(
+    vaParser *parser,
+    uchar *p)
+{
+    uint64 xCount = reserveCount(parser);
+    uint64 count = 0;
+
+    if(!enterContainer(parser, p)) {
+        return NULL;
+    }
+    p = skipSpace(p);
+    if(*p != '|' || p[1] != '>') {
+        while(true) {
+            p = scanValue(parser, p);
+            if(p == NULL) {
+                return NULL;
+            }
+            p = skipSpace(p);
+            if(*p != ':') {
+                return syntaxError(parser, p, "Expected a key:value pair");
+            }
+            p = scanValue(parser, p + 1);
+            if(p == NULL) {
+                return NULL;
+            }
+            count++;
+            p = skipSpace(p);
+            if(*p == '|' && p[1] == '>') {
+                break;
+            }
+            if(*p != ',') {
+                return syntaxError(parser, p, "Expected , or |> in dictionary");
+            }
+            p++;
+        }
+    }
+    if(!leaveContainer(parser, p, xCount, count)) {
+        return NULL;
+    }
+    return p + 2;
+}
+
+// Check a string, after its opening quote.
+static uchar *scanString(
+    vaParser *parser,
+    uchar *p)
+{
+    uchar *start = p - 1;
+
+    while(true) {
+        p = findStringSpecial(p);
+        if(*p == '"') {
+            return p + 1;
+        }
+        if(*p == '\0' || p[1] == '\0') {
+            return syntaxError(parser, start, "Unterminated string");
+        }
+        p += 2;
+    }
+}
+
+// Check an ident.
+static uchar *scanIdent(
+    vaParser *parser,
+    uchar *p)
+{
+    uchar *start = p;
+
+    if(*p != '\\' && (!isIdentChar(*p) || isdigit(*p))) {
+        return syntaxError(parser, p, "Invalid value");
+    }
+    while(true) {
+        if(*p == '\\') {
+            if(p[1] == '\0') {
+                return syntaxError(parser, start, "Invalid zero embedded in ident");
+            }
+            p += 2;
+        } else if(isIdentChar(*p)) {
+            p++;
+        } else {
+            return p;
+        }
+    }
+}
+
+// Check a blob, or a float or double written as its bytes, starting at the 0.
+static uchar *scanBlob(
+    vaParser *parser,
+    uchar *p)
+{
+    uchar type = p[1];
+    uchar *start = p + 2;
+
+    p = vaSkipHexDigits(start);
+    if(((p - start) & 1) != 0) {
+        return syntaxError(parser, p, "Expected an even number of hex digits in blob");
+    }
+    if((type == 'f' && p - start != 8) || (type == 'd' && p - start != 16)) {
+        return syntaxError(parser, start, "Wrong number of hex digits in float");
+    }
+    return p;
+}
+
+// Check the syntax of a value, and count the elements of its containers.  Return a pointer
+// after the value, or NULL on a syntax error.
+static uchar *scanValue(
+    vaParser *parser,
+    uchar *p)
+{
+    vaNumber number;
+    uint64 value;
+
+    p = skipSpace(p);
+    switch(*p) {
+    case '\0': return syntaxError(parser, p, "Unexpected end of value");
+    case '[': return scanList(parser, p + 1, ']');
+    case '(': return scanList(parser, p + 1, ')');
+    case '"': return scanString(parser, p + 1);
+    case '<':
+        if(p[1] == '|') {
+            return scanDictionary(parser, p + 2);
+        }
+        break;
+    case '0':
+        if(p[1] == 'p') {
+            return readHex(parser, p + 2, &value);
+        }
+        if(p[1] == 'b' || p[1] == 'f' || p[1] == 'd') {
+            return scanBlob(parser, p);
+        }
+        break;
+    }
+    if(isdigit(*p) || *p == '-' || *p == '+') {
+        return readNumber(parser, p, &number);
+    }
+    return scanIdent(parser, p);
+}
+
+// Forward declaration for recursion.
+static vaValue buildValue(vaParser *parser, uchar **bytesPtr);
+
+// Build a tuple or list, whose element count was found by the first pass.
+static vaList buildList(
+    vaParser *parser,
+    uchar **bytesPtr)
+{
+    uint32 count = parser->counts[parser->countPos++];
+    vaList list = vaListCreate();
+    uchar *bytes = *bytesPtr + 1;
+    uint32 xValue;
+
+    if(count != 0) {
+        vaListResizeValues(list, count);
+    }
+    for(xValue = 0; xValue < count; xValue++) {
+        vaListAppendValue(list, buildValue(parser, &bytes));
+        // Skip the comma or closing bracket.
+        bytes = skipSpace(bytes) + 1;
+    }
+    if(count == 0) {
+        bytes = skipSpace(bytes) + 1;
+    }
+    *bytesPtr = bytes;
+    return list;
+}
+
+// Build a dictionary, whose entry count was found by the first pass.
+static vaValue buildDictionary(
+    vaParser *parser,
+    uchar **bytesPtr)
+{
+    uint32 count = parser->counts[parser->countPos++];
+    vaDictionary dictionary = vaDictionaryCreate();
+    uchar *bytes = *bytesPtr + 2;
+    uint32 xEntry;
+    vaValue key;
+
+    if(count != 0) {
+        vaDictionaryReserve(dictionary, count);
+    }
+    for(xEntry = 0; xEntry < count; xEntry++) {
+        key = buildValue(parser, &bytes);
+        bytes = skipSpace(bytes) + 1;
+        vaDictionaryInsertValue(dictionary, key, buildValue(parser, &bytes));
+        bytes = skipSpace(bytes);
+        bytes += *bytes == ','? 1 : 2;
+    }
+    if(count == 0) {
+        bytes = skipSpace(bytes) + 2;
+    }
+    *bytesPtr = bytes;
+    return vaDictionaryValueCreate(dictionary);
+}
+
+// Build a string.  Runs of characters without escapes are copied in one piece.
+static vaValue buildString(
+    vaParser *parser,
+    uchar **bytesPtr)
+{
+    uchar *bytes = *bytesPtr + 1;
+    uchar *special;
+
+    parser->pos = 0;
+    while(true) {
+        special = findStringSpecial(bytes);
+        addBytes(parser, bytes, special - bytes);
+        if(*special == '"') {
+            break;
+        }
+        addByte(parser, unescape(special[1]));
+        bytes = special + 2;
+    }
+    addByte(parser, '\0');
+    *bytesPtr = special + 1;
+    return vaStringValueCreate(vaStringCreate(parser->buffer));
+}
+
+// Build an ident, or true, false or null, when written without escapes.
+static vaValue buildIdent(
+    vaParser *parser,
+    uchar **bytesPtr)
+{
+    uchar *bytes = *bytesPtr;
+    bool hasEscape = false;
+    char *name;
+
+    parser->pos = 0;
+    while(true) {
+        if(*bytes == '\\') {
+            addByte(parser, unescape(bytes[1]));
+            hasEscape = true;
+            bytes += 2;
+        } else if(isIdentChar(*bytes)) {
+            addByte(parser, *bytes++);
+        } else {
+            break;
+        }
+    }
+    addByte(parser, '\0');
+    *bytesPtr = bytes;
+    name = (char *)parser->buffer;
+    if(!hasEscape) {
+        if(!strcmp(name, "true")) {
+            return vaBoolValueCreate(true);
+        }
+        if(!strcmp(name, "false")) {
+            return vaBoolValueCreate(false);
+        }
+        if(!strcmp(name, "null")) {
+            return vaNullValueCreate();
+        }
+    }
+    return vaIdentValueCreate(utSymCreate(name));
+}
+
+// Build a blob, or a float or double written as its bytes.
+static vaValue buildBlob(
+    vaParser *parser,
+    uchar **bytesPtr)
+{
+    uchar type = (*bytesPtr)[1];
+    uchar *text = *bytesPtr + 2;
+    uchar *end = vaSkipHexDigits(text);
+    uint8 bytes[sizeof(double)];
+
+    *bytesPtr = end;
+    if(type == 'f') {
+        vaHexDecode(text, bytes, sizeof(float));
+        return vaFloatValueCreate(vaDecodeFloat(bytes));
+    }
+    if(type == 'd') {
+        vaHexDecode(text, bytes, sizeof(double));
+        return vaDoubleValueCreate(vaDecodeDouble(bytes));
+    }
+    return vaBlobValueCreate(vaBlobCreateFromHex(text, (end - text) >> 1));
+}
+
+// Build a number.
+static vaValue buildNumber(
+    vaParser *parser,
+    uchar **bytesPtr)
+{
+    vaNumber number;
+
+    *bytesPtr = readNumber(parser, *bytesPtr, &number);
+    switch(number.type) {
+    case VA_POSINT: return vaPosIntValueCreate(number.uintVal);
+    case VA_NEGINT: return vaNegIntValueCreate(number.uintVal);
+    case VA_FLOAT: return vaFloatValueCreate(number.doubleVal);
+    default:
+        return vaDoubleValueCreate(number.doubleVal);
+    }
+}
+
+// Build the value from text the first pass has checked.
+static vaValue buildValue(
+    vaParser *parser,
+    uchar **bytesPtr)
+{
+    uchar *bytes = skipSpace(*bytesPtr);
+    uint64 value;
+
+    *bytesPtr = bytes;
+    switch(*bytes) {
+    case '[': return vaListValueCreate(buildList(parser, bytesPtr));
+    case '(': return vaTupleValueCreate(buildList(parser, bytesPtr));
+    case '"': return buildString(parser, bytesPtr);
+    case '<':
+        if(bytes[1] == '|') {
+            return buildDictionary(parser, bytesPtr);
+        }
+        break;
+    case '0':
+        if(bytes[1] == 'p') {
+            *bytesPtr = readHex(parser, bytes + 2, &value);
+            return vaObjectValueCreate(value);
+        }
+        if(bytes[1] == 'b' || bytes[1] == 'f' || bytes[1] == 'd') {
+            return buildBlob(parser, bytesPtr);
+        }
+        break;
+    }
+    if(isdigit(*bytes) || *bytes == '-' || *bytes == '+') {
+        return buildNumber(parser, bytesPtr);
+    }
+    return buildIdent(parser, bytesPtr);
+}
+
+// Set up a parser for the first pass.
+static void initParser(
+    vaParser *parser)
+{
+    memset(parser, 0, sizeof(vaParser));
+    parser->countsSize = 64;
+    parser->counts = resizeScratch(NULL, parser->countsSize*sizeof(uint32));
+}
+
+// Allocate the parser's buffer for the second pass.
+static void startBuild(
+    vaParser *parser)
+{
+    parser->size = 256;
+    parser->buffer = resizeScratch(NULL, parser->size);
+}
+
+// Free the parser's memory.
+static void freeParser(
+    vaParser *parser)
+{
+    free(parser->counts);
+    free(parser->buffer);
+}
+
+// Set the number of threads used to parse large text.  The default is 1.
+void vaSetParseThreads(
+    uint32 numThreads)
+{
+    if(numThreads == 0) {
+        numThreads = 1;
+    }
+    vaParseThreads = numThreads > VA_MAX_PARSE_THREADS? VA_MAX_PARSE_THREADS : numThreads;
+}
+
+// Skip a string, after its opening quote.  Return NULL if it is not terminated.
+static uchar *skipString(
+    uchar *p)
+{
+    while(true) {
+        p = findStringSpecial(p);
+        if(*p == '"') {
+            return p + 1;
+        }
+        if(*p == '\0' || p[1] == '\0') {
+            return NULL;
+        }
+        p += 2;
+    }
+}
+
+// Find the closing bracket of the top-level container whose elements start at p, and split
+// the elements into at most maxGroups groups of about groupBytes bytes each, at top-level
+// commas.  Only brackets, strings and escapes are looked at.  Return NULL if the brackets do
+// not balance, and leave the error to the sequential parser.
+static uchar *indexContainer(
+    uchar *p,
+    uint64 groupBytes,
+    uchar **splits,
+    uint32 maxGroups,
+    uint32 *numGroups)
+{
+    uchar *nextSplit = p + groupBytes;
+    uint32 depth = 1;
+
+    *numGroups = 1;
+    while(true) {
+        switch(*p) {
+        case '\0':
+            return NULL;
+        case '"':
+            p = skipString(p + 1);
+            if(p == NULL) {
+                return NULL;
+            }
+            continue;
+        case '\\':
+            if(p[1] == '\0') {
+                return NULL;
+            }
+            p++;
+            break;
+        case '[': case '(':
+            depth++;
+            break;
+        case '<':
+            if(p[1] == '|') {
+                depth++;
+                p++;
+            }
+            break;
+        case ']': case ')':
+            if(--depth == 0) {
+                return p;
+            }
+            break;
+        case '|':
+            if(p[1] == '>') {
+                if(--depth == 0) {
+                    return p;
+                }
+                p++;
+            }
+            break;
+        case ',':
+            if(depth == 1 && p >= nextSplit && *numGroups < maxGroups) {
+                splits[*numGroups - 1] = p;
+                (*numGroups)++;
+                nextSplit = p + groupBytes;
+            }
+            break;
+        }
+        p++;
+    }
+}
+
+// Check and count the elements of a group.  This runs on its own thread.
+static void *scanGroup(
+    void *arg)
+{
+    vaParseGroup *group = (vaParseGroup *)arg;
+    vaParser *parser = &group->parser;
+    uchar *p = group->start;
+
+    parser->depth = 1;
+    group->failed = true;
+    while(true) {
+        p = scanValue(parser, p);
+        if(p != NULL && group->isDictionary) {
+            p = skipSpace(p);
+            p = *p == ':'? scanValue(parser, p + 1) : NULL;
+        }
+        if(p == NULL) {
+            return NULL;
+        }
+        group->numElements++;
+        p = skipSpace(p);
+        if(p >= group->end) {
+            break;
+        }
+        if(*p != ',') {
+            return NULL;
+        }
+        p++;
+    }
+    group->failed = p != group->end;
+    return NULL;
+}
+
+// Build the elements of a group, in order, into the top-level list or dictionary.
+static void buildGroup(
+    vaParseGroup *group,
+    vaList list,
+    vaDictionary dictionary)
+{
+    vaParser *parser = &group->parser;
+    uchar *bytes = group->start;
+    uint64 xElement;
+    vaValue key;
+
+    for(xElement = 0; xElement < group->numElements; xElement++) {
+        if(group->isDictionary) {
+            key = buildValue(parser, &bytes);
+            bytes = skipSpace(bytes) + 1;
+            vaDictionaryInsertValue(dictionary, key, buildValue(parser, &bytes));
+        } else {
+            vaListAppendValue(list, buildValue(parser, &bytes));
+        }
+        // Skip the comma.
+        bytes = skipSpace(bytes) + 1;
+    }
+}
+
+// Build the checked groups into the top-level container.
+static vaValue buildGroups(
+    vaParseGroup *groups,
+    uint32 numGroups,
+    uchar open)
+{
+    vaList list = vaListNull;
+    vaDictionary dictionary = vaDictionaryNull;
+    uint64 numElements = 0;
+    uint32 xGroup;
+
+    for(xGroup = 0; xGroup < numGroups; xGroup++) {
+        numElements += groups[xGroup].numElements;
+    }
+    if(numElements > UINT32_MAX) {
+        return vaValueNull;
+    }
+    if(open == '<') {
+        dictionary = vaDictionaryCreate();
+        vaDictionaryReserve(dictionary, numElements);
+    } else {
+        list = vaListCreate();
+        vaListResizeValues(list, numElements);
+    }
+    for(xGroup = 0; xGroup < numGroups; xGroup++) {
+        startBuild(&groups[xGroup].parser);
+        buildGroup(groups + xGroup, list, dictionary);
+    }
+    if(open == '<') {
+        return vaDictionaryValueCreate(dictionary);
+    }
+    return open == '['? vaListValueCreate(list) : vaTupleValueCreate(list);
+}
+
+// Parse a large top-level tuple, list or dictionary, checking groups of its elements on
+// several threads.  Return vaValueNull if the text is not a container with at least two
+// groups of elements, or has any syntax error, and let the sequential parser handle it.
+static vaValue parseParallel(
+    uchar *text,
+    uint64 length)
+{
+    vaParseGroup groups[VA_MAX_PARSE_THREADS];
+    uchar *splits[VA_MAX_PARSE_THREADS];
+    uchar *p = skipSpace(text);
+    uchar open = *p;
+    uchar *close;
+    uchar closeChar;
+    uint32 numGroups, xGroup;
+    vaValue value = vaValueNull;
+    bool failed = false;
+
+    if(open == '[' || open == '(') {
+        p++;
+    } else if(open == '<' && p[1] == '|') {
+        p += 2;
+    } else {
+        return vaValueNull;
+    }
+    close = indexContainer(p, length/vaParseThreads, splits, vaParseThreads, &numGroups);
+    // indexContainer accepts any closing bracket, so check it matches.  A '|' it returns is
+    // always followed by '>'.
+    closeChar = open == '['? ']' : open == '('? ')' : '|';
+    if(close == NULL || numGroups < 2 || *close != closeChar ||
+            *skipSpace(close + (open == '<'? 2 : 1)) != '\0') {
+        return vaValueNull;
+    }
+    splits[numGroups - 1] = close;
+    for(xGroup = 0; xGroup < numGroups; xGroup++) {
+        initParser(&groups[xGroup].parser);
+        groups[xGroup].start = xGroup == 0? p : splits[xGroup - 1] + 1;
+        groups[xGroup].end = splits[xGroup];
+        groups[xGroup].numElements = 0;
+        groups[xGroup].isDictionary = open == '<';
+        // The calling thread checks the first group itself.
+        groups[xGroup].threadStarted = xGroup != 0 && pthread_create(&groups[xGroup].thread,
+            NULL, scanGroup, groups + xGroup) == 0;
+    }
+    for(xGroup = 0; xGroup < numGroups; xGroup++) {
+        if(groups[xGroup].threadStarted) {
+            pthread_join(groups[xGroup].thread, NULL);
+        } else {
+            scanGroup(groups + xGroup);
+        }
+        failed |= groups[xGroup].failed;
+    }
+    if(!failed) {
+        value = buildGroups(groups, numGroups, open);
+    }
+    for(xGroup = 0; xGroup < numGroups; xGroup++) {
+        freeParser(&groups[xGroup].parser);
+    }
+    return value;
+}
+
+// Parse the zero-terminated text of a value.  On a syntax error, return vaValueNull, and set
+// message and offset to say what is wrong and where.  No values are created for text with
+// errors.
+vaValue vaTryParseValue(
+    uchar *text,
+    char **message,
+    uint64 *offset)
+{
+    vaParser parser;
+    vaValue value;
+    uint64 length;
+    uchar *end;
+
+    if(vaParseThreads > 1) {
+        length = strlen((char *)text);
+        if(length >= VA_MIN_PARALLEL_BYTES) {
+            value = parseParallel(text, length);
+            if(value != vaValueNull) {
+                return value;
+            }
+        }
+    }
+    initParser(&parser);
+    value = vaValueNull;
+    end = scanValue(&parser, text);
+    if(end != NULL && *skipSpace(end) != '\0') {
+        end = syntaxError(&parser, skipSpace(end), "Extra text after value");
+    }
+    if(end == NULL) {
+        *message = parser.message;
+        *offset = parser.errorPos - text;
+    } else {
+        startBuild(&parser);
+        value = buildValue(&parser, &text);
+    }
+    freeParser(&parser);
+    return value;
+}
+
+// Parse the zero-terminated text of a value, and exit on syntax errors.
+vaValue vaParseValue(
+    uchar *text)
+{
+    char *message;
+    uint64 offset;
+    vaValue value = vaTryParseValue(text, &message, &offset);
+
+    if(value == vaValueNull) {
+        utExit("%s: %.40s", message, text + offset);
+    }
+    return value;
+}
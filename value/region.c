@@ -0,0 +1,120 @@
+/* Regions are reference-counted blocks of bytes, such as a mapped file or a received
+   message, that blobs can borrow instead of copying.  Each borrowing blob holds a
+   reference, which is dropped when the blob is destroyed, and the bytes are released when
+   the last reference goes.  Counts are updated atomically, so threads reading the bytes
+   can hold references of their own. */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "value.h"
+
+struct vaRegionStruct {
+    uint8 *bytes;
+    uint64 length;
+    uint32 refCount;
+    vaRegionReleaseFunc release; // Called on the bytes when the last reference is dropped
+    void *context;
+};
+
+// Create a region over the bytes, with one reference held by the caller.  The release
+// function, if not NULL, is called on the bytes when the last reference is dropped.
+vaRegion vaRegionCreate(
+    uint8 *bytes,
+    uint64 length,
+    vaRegionReleaseFunc release,
+    void *context)
+{
+    vaRegion region = utNew(struct vaRegionStruct);
+
+    region->bytes = bytes;
+    region->length = length;
+    region->refCount = 1;
+    region->release = release;
+    region->context = context;
+    return region;
+}
+
+// Free malloced bytes.
+static void releaseMalloc(
+    void *context,
+    uint8 *bytes,
+    uint64 length)
+{
+    free(bytes);
+}
+
+// Create a region that takes ownership of malloced bytes.
+vaRegion vaMallocRegionCreate(
+    uint8 *bytes,
+    uint64 length)
+{
+    return vaRegionCreate(bytes, length, releaseMalloc, NULL);
+}
+
+// Unmap a mapped file.
+static void releaseMapping(
+    void *context,
+    uint8 *bytes,
+    uint64 length)
+{
+    if(length != 0) {
+        munmap(bytes, length);
+    }
+}
+
+// Map the file read-only into a region.  Return NULL if it can't be opened or mapped.
+vaRegion vaFileRegionCreate(
+    char *fileName)
+{
+    struct stat status;
+    void *bytes = NULL;
+    int fd = open(fileName, O_RDONLY);
+
+    if(fd < 0) {
+        return NULL;
+    }
+    if(fstat(fd, &status) != 0) {
+        close(fd);
+        return NULL;
+    }
+    if(status.st_size != 0) {
+        bytes = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if(bytes == MAP_FAILED) {
+        return NULL;
+    }
+    return vaRegionCreate(bytes, status.st_size, releaseMapping, NULL);
+}
+
+// Add a reference to the region.
+void vaRegionRef(
+    vaRegion region)
+{
+    __atomic_add_fetch(&region->refCount, 1, __ATOMIC_RELAXED);
+}
+
+// Drop a reference to the region, and release it when none are left.
+void vaRegionUnref(
+    vaRegion region)
+{
+    if(__atomic_sub_fetch(&region->refCount, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    if(region->release != NULL) {
+        region->release(region->context, region->bytes, region->length);
+    }
+    utFree(region);
+}
+
+// Return the bytes of the region.
+uint8 *vaRegionGetBytes(
+    vaRegion region,
+    uint64 *length)
+{
+    *length = region->length;
+    return region->bytes;
+}
@@ -0,0 +1,212 @@
+/* Sinks collect output in a fixed-size buffer, and pass it in chunks to a write function,
+   so large values can be streamed to a file, pipe or socket in constant memory.  Payloads
+   too large to be worth copying are written straight from the caller's memory, together
+   with the buffered bytes, in one gathered write.
+
+   A memory sink has no write function, and grows its buffer to hold everything instead. */
+
+#include <errno.h>
+#include <unistd.h>
+#include "value.h"
+
+#define VA_SINK_BUFFER_SIZE (1 << 16)
+#define VA_MEMORY_SINK_SIZE 256
+
+// Create a sink with a write function.  Writes return false on failure, after which the
+// sink drops its output.
+vaSink vaSinkCreate(
+    vaSinkWriteFunc write,
+    void *context)
+{
+    vaSink sink = utNew(struct vaSinkStruct);
+
+    sink->write = write;
+    sink->context = context;
+    sink->size = write == NULL? VA_MEMORY_SINK_SIZE : VA_SINK_BUFFER_SIZE;
+    sink->buffer = utNewA(uint8, sink->size);
+    sink->used = 0;
+    sink->failed = false;
+    return sink;
+}
+
+// Create a sink that keeps its output in memory.
+vaSink vaMemorySinkCreate(void)
+{
+    return vaSinkCreate(NULL, NULL);
+}
+
+// Write the chunks to a file descriptor, resuming after partial writes.
+static bool writeFd(
+    void *context,
+    struct iovec *chunks,
+    uint32 numChunks)
+{
+    int fd = (int)(intptr_t)context;
+    ssize_t written;
+
+    while(numChunks != 0) {
+        written = writev(fd, chunks, numChunks);
+        if(written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        while(numChunks != 0 && (size_t)written >= chunks->iov_len) {
+            written -= chunks->iov_len;
+            chunks++;
+            numChunks--;
+        }
+        if(numChunks != 0) {
+            chunks->iov_base = (uint8 *)chunks->iov_base + written;
+            chunks->iov_len -= written;
+        }
+    }
+    return true;
+}
+
+// Create a sink that writes to a file descriptor.  The caller still owns the descriptor.
+vaSink vaFdSinkCreate(
+    int fd)
+{
+    return vaSinkCreate(writeFd, (void *)(intptr_t)fd);
+}
+
+// Write the chunks to a FILE.
+static bool writeFile(
+    void *context,
+    struct iovec *chunks,
+    uint32 numChunks)
+{
+    FILE *file = (FILE *)context;
+    uint32 xChunk;
+
+    for(xChunk = 0; xChunk < numChunks; xChunk++) {
+        if(fwrite(chunks[xChunk].iov_base, 1, chunks[xChunk].iov_len, file) !=
+                chunks[xChunk].iov_len) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Create a sink that writes to a FILE.  The caller still owns the FILE, and must fflush it.
+vaSink vaFileSinkCreate(
+    FILE *file)
+{
+    return vaSinkCreate(writeFile, file);
+}
+
+// Add the chunks to a hasher.
+static bool writeHasher(
+    void *context,
+    struct iovec *chunks,
+    uint32 numChunks)
+{
+    vaHasher *hasher = (vaHasher *)context;
+    uint32 xChunk;
+
+    for(xChunk = 0; xChunk < numChunks; xChunk++) {
+        vaHasherAdd(hasher, chunks[xChunk].iov_base, chunks[xChunk].iov_len);
+    }
+    return true;
+}
+
+// Create a sink that hashes its output without keeping it.  Flush the sink before
+// finishing the hash.
+vaSink vaHashSinkCreate(
+    vaHasher *hasher)
+{
+    return vaSinkCreate(writeHasher, hasher);
+}
+
+// Destroy the sink.  Bytes not yet flushed are dropped.
+void vaSinkDestroy(
+    vaSink sink)
+{
+    utFree(sink->buffer);
+    utFree(sink);
+}
+
+// Pass the buffered bytes and then the payload to the write function.
+static void writeChunks(
+    vaSink sink,
+    uint8 *bytes,
+    uint64 length)
+{
+    struct iovec chunks[2];
+    uint32 numChunks = 0;
+
+    if(sink->used != 0) {
+        chunks[numChunks].iov_base = sink->buffer;
+        chunks[numChunks++].iov_len = sink->used;
+    }
+    if(length != 0) {
+        chunks[numChunks].iov_base = bytes;
+        chunks[numChunks++].iov_len = length;
+    }
+    sink->used = 0;
+    if(numChunks != 0 && !sink->failed && !sink->write(sink->context, chunks, numChunks)) {
+        sink->failed = true;
+    }
+}
+
+// Write out the buffered bytes.  Return false if any write to the sink has failed.
+bool vaSinkFlush(
+    vaSink sink)
+{
+    if(sink->write != NULL) {
+        writeChunks(sink, NULL, 0);
+    }
+    return !sink->failed;
+}
+
+// Make room in the buffer for length more bytes, by growing a memory sink, or flushing any
+// other.  Length must not be more than the buffer size of other sinks.
+void vaSinkMakeRoom(
+    vaSink sink,
+    uint64 length)
+{
+    if(sink->write != NULL) {
+        writeChunks(sink, NULL, 0);
+        return;
+    }
+    while(sink->size - sink->used < length) {
+        sink->size <<= 1;
+    }
+    utResizeArray(sink->buffer, sink->size);
+}
+
+// Add bytes to the sink.  Large payloads are written without copying them into the buffer.
+void vaSinkWrite(
+    vaSink sink,
+    uint8 *bytes,
+    uint64 length)
+{
+    if(sink->size - sink->used >= length) {
+        memcpy(sink->buffer + sink->used, bytes, length);
+        sink->used += length;
+    } else if(sink->write != NULL && length >= (sink->size >> 1)) {
+        writeChunks(sink, bytes, length);
+    } else {
+        vaSinkMakeRoom(sink, length);
+        memcpy(sink->buffer + sink->used, bytes, length);
+        sink->used += length;
+    }
+}
+
+// Return the bytes held by a memory sink.  They belong to the sink.
+uint8 *vaSinkGetBytes(
+    vaSink sink,
+    uint64 *length)
+{
+    *length = sink->used;
+    return sink->buffer;
+}
+
+// Drop the bytes held by a memory sink, so it can be reused.
+void vaSinkClear(
+    vaSink sink)
+{
+    sink->used = 0;
+}
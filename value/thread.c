@@ -1,99 +1,121 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <setjmp.h>
+/* Coroutine threads.  Each coThread runs on its own stack, and control moves between them
+   only when one explicitly switches to another, so no locking is needed.  This lets a
+   routine that pulls its input, like the parser, be driven by a caller that pushes input.
 
-#define MAXTHREAD 4
-#define STACKDIR - // set to + for upwards and - for downwards
-#define STACKSIZE (1<<18)
+   Stacks are created with makecontext, rather than by carving up the C stack with
+   setjmp/longjmp, which is undefined behavior and breaks as soon as a coroutine recurses
+   deeper than its slice. */
 
-struct threadStruct {
-    jmp_buf stackBuf;
-    char *stackPtr;
+#include <stdlib.h>
+#include <ucontext.h>
+#include "value.h"
+
+#define CO_DEFAULT_STACK_SIZE (1 << 20)
+
+struct coThreadStruct {
+    ucontext_t context;
+    coThreadFunc func;
+    void *arg;
+    uint8 *stack;
+    coThread caller; // The thread that last switched to this one
+    bool finished;
 };
 
-typedef struct threadStruct *coThread;
+static struct coThreadStruct coMainThread;
+static coThread coCurrentThread;
 
-static char *tos; // top of stack
-static void *coarg;
-static struct threadStruct coThreads[MAXTHREAD];
-static int coNumThreads = 0;
+// Return the running thread.  The first call adopts the caller's stack as the main thread.
+coThread coGetCurrentThread(void)
+{
+    if(coCurrentThread == NULL) {
+        coCurrentThread = &coMainThread;
+    }
+    return coCurrentThread;
+}
 
-static inline coThread coThreadAlloc(void) { return coThreads + coNumThreads++; }
+// Run the thread's function, and return to the caller for good when it finishes.
+static void runThread(void)
+{
+    coThread thread = coCurrentThread;
 
-void *coSwitchToThread(coThread currentThread, coThread newThread) {
-    if (setjmp(currentThread->stackBuf)) {
-        return(coarg);
-    }
-    longjmp(newThread->stackBuf, 1);
+    thread->func(thread->arg);
+    thread->finished = true;
+    coYield();
 }
 
-void *coNewThread(coThread currentThread, void (*fun)(coThread)) {
-    coThread newThread = coThreadAlloc();
+// Create a new thread which starts running func(arg) on the first switch to it.  A
+// stackSize of 0 selects the default size.
+coThread coThreadCreate(
+    coThreadFunc func,
+    void *arg,
+    uint32 stackSize)
+{
+    coThread thread = utNew(struct coThreadStruct);
 
-    if (tos == NULL) {
-        tos = (char*)&newThread;
+    if(stackSize == 0) {
+        stackSize = CO_DEFAULT_STACK_SIZE;
     }
-    tos += STACKDIR STACKSIZE;
-    char n[STACKDIR (tos - (char*)&newThread)];
-    coarg = n; // ensure optimizer keeps n
-    if (setjmp(currentThread->stackBuf)) {
-        return(coarg);
+    memset(thread, 0, sizeof(struct coThreadStruct));
+    thread->func = func;
+    thread->arg = arg;
+    thread->stack = utNewA(uint8, stackSize);
+    if(getcontext(&thread->context) != 0) {
+        utExit("Unable to create coroutine context");
     }
-    fun(newThread);
-    abort();
+    thread->context.uc_stack.ss_sp = thread->stack;
+    thread->context.uc_stack.ss_size = stackSize;
+    thread->context.uc_link = NULL;
+    makecontext(&thread->context, runThread, 0);
+    return thread;
 }
 
-static void comain(coThread thread) {
-    int i = thread - coThreads;
-
-    for (;;) {
-        printf("coroutine %d\n", i, i);
-        int n = rand() % coNumThreads;
-        printf("jumping to %d\n", n);
-        coSwitchToThread(coThreads + i, coThreads + n);
-    }
+// Free a thread's stack.  It must not be running.
+void coThreadDestroy(
+    coThread thread)
+{
+    utAssert(thread != coCurrentThread);
+    utFree(thread->stack);
+    utFree(thread);
 }
 
-/*
-int main(void) {
-    coThread mainThread = coThreadAlloc();
-    int i;
+// Suspend the running thread, and resume the new one where it left off.  This returns when
+// some thread switches back.
+void coSwitchToThread(
+    coThread newThread)
+{
+    coThread oldThread = coGetCurrentThread();
 
-    for(i = 0; i < MAXTHREAD - 1; i++) {
-        printf("spawning %d\n", i);
-        coStartThread(mainThread, comain);
+    if(newThread->finished) {
+        utExit("Switching to a finished coroutine");
     }
-    return 0;
+    newThread->caller = oldThread;
+    coCurrentThread = newThread;
+    swapcontext(&oldThread->context, &newThread->context);
 }
-*/
-
-static char text[100]
 
-static void produceText(coThread mainThread)
+// Switch back to the thread that last switched to this one.
+void coYield(void)
 {
-    static int counter = 1;
+    coThread thread = coGetCurrentThread();
 
-    while(true) {
-        sprintf(text, "Count = %d", counter++);
-        coSwitchToThread(mainThread);
-    }
+    utAssert(thread->caller != NULL);
+    coSwitchToThread(thread->caller);
 }
 
-static void consumeText(coThread mainthread)
+// Give up on the running thread after a longjmp has left its stack, making the thread that
+// last switched to it current again.  The abandoned thread can only be destroyed.
+void coAbort(void)
 {
-    while(true) {
-        printf("%s\n", text);
-        coSwitchToThread(mainThread);
-    }
-}
+    coThread thread = coGetCurrentThread();
 
-int main(void) {
-    coThread mainThread = coThreadAlloc();
-    coThread producer = coNewThread(mainThread, produceText);
-    coThread consumer = coNewThread(mainThread, consumeText);
+    utAssert(thread->caller != NULL);
+    thread->finished = true;
+    coCurrentThread = thread->caller;
+}
 
-    while(true) {
-        coSwitchToThread(producer);
-        coSwitchToThread(consumer);
-    }
+// Determine if the thread's function has returned.
+bool coThreadFinished(
+    coThread thread)
+{
+    return thread->finished;
 }
@@ -0,0 +1,12 @@
+// Coroutine thread module
+
+typedef struct coThreadStruct *coThread;
+typedef void (*coThreadFunc)(void *arg);
+
+coThread coThreadCreate(coThreadFunc func, void *arg, uint32 stackSize);
+void coThreadDestroy(coThread thread);
+void coSwitchToThread(coThread newThread);
+void coYield(void);
+void coAbort(void);
+coThread coGetCurrentThread(void);
+bool coThreadFinished(coThread thread);
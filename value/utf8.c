@@ -79,8 +79,9 @@ int utf8FindLengthAndValidate(uchar *p, bool *valid)
 }
 
 // Make sure that only valid UTF-8 characters are in the line, and that all
-// control characters are gone.
-static void validateLine(void)
+// control characters are gone.  The line is edited in place.
+void utf8ValidateLine(
+    uchar *line)
 {
     uchar *p = line;
     uchar *q = line;
@@ -151,6 +152,6 @@ uchar *utf8ReadLine(
     if(!readLineRaw()) {
         return NULL;
     }
-    validateLine();
+    utf8ValidateLine(line);
     return line;
 }
@@ -5,6 +5,7 @@ typedef unsigned char uchar;
 void utf8Start(void);
 void utf8Stop(void);
 uchar *utf8ReadLine(FILE *file);
+void utf8ValidateLine(uchar *line);
 static inline int utf8FindLength(uchar c) {
     int expectedLength = 1;
     while(c & 0x80) {
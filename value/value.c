@@ -1,14 +1,17 @@
 // Value methods.
-#include <stdlib.h>
-#include <ctype.h>
 #include "value.h"
 
 vaRoot vaTheRoot;
 utSym vaTrueSym, vaFalseSym, vaNullSym;
 
-static uchar *vaStringBuffer;
-static uint64 vaStringSize, vaStringPos;
-static bool vaUseHexFloats;
+static vaSink vaTextSink; // Holds the text returned by vaValue2String
+static bool vaHashConsing;
+static vaDictionary vaConsTable; // Maps each shared value to itself
+// Values for booleans, null and small integers are created once and shared, so they must
+// not be modified or destroyed.
+#define VA_NUM_SMALL_INTS 256
+static vaValue vaTrueValue, vaFalseValue, vaNullValue;
+static vaValue vaSmallPosInts[VA_NUM_SMALL_INTS], vaSmallNegInts[VA_NUM_SMALL_INTS];
 
 // Initialize the value module.
 void vaValueStart(void)
@@ -21,300 +24,211 @@ void vaValueStart(void)
     vaTrueSym = utSymCreate("true");
     vaFalseSym = utSymCreate("false");
     vaNullSym = utSymCreate("null");
-    vaStringSize = 42;
-    vaStringBuffer = utNewA(uchar, vaStringSize);
+    vaTextSink = vaMemorySinkCreate();
 }
 
 // Free memory used by the value module.
 void vaValueStop(void)
 {
-    utFree(vaStringBuffer);
+    vaSinkDestroy(vaTextSink);
+    vaHashConsing = false;
+    vaConsTable = vaDictionaryNull;
+    vaTrueValue = vaValueNull;
+    vaFalseValue = vaValueNull;
+    vaNullValue = vaValueNull;
+    memset(vaSmallPosInts, 0, sizeof(vaSmallPosInts));
+    memset(vaSmallNegInts, 0, sizeof(vaSmallNegInts));
     vaBencodeStop();
     utf8Stop();
     vaDatabaseStop();
 }
 
-// Add the single byte character to the string buffer.
-static inline void addChar(
-    uchar c)
-{
-    if(vaStringPos == vaStringSize) {
-        vaStringSize += vaStringSize >> 1;
-        utResizeArray(vaStringBuffer, vaStringSize);
-    }
-    vaStringBuffer[vaStringPos++] = c;
-}
-
-// Add the string to the string buffer.
-static inline void addString(
-    char *string)
-{
-    uint64 length = strlen(string);
-
-    if(vaStringPos + length >= vaStringSize) {
-        vaStringSize += (vaStringSize >> 1) + length;
-        utResizeArray(vaStringBuffer, vaStringSize);
-    }
-    strcpy((char *)(vaStringBuffer + vaStringPos), string);
-    vaStringPos += length;
-}
-
-// Add a utf8 character and return a pointer to the next character.
-static inline void addUtf8Char(
-    uchar **bytesPtr)
-{
-    uchar *bytes = *bytesPtr;
-    int length = utf8FindLength(*bytes);
-
-    if(vaStringPos + length >= vaStringSize) {
-        vaStringSize += (vaStringSize >> 1) + length;
-        utResizeArray(vaStringBuffer, vaStringSize);
-    }
-    while(length--) {
-        vaStringBuffer[vaStringPos++] = *bytes++;
-    }
-    *bytesPtr = bytes;
-}
-
-
-// Print a formatted string to the end of the string buffer.
-static void addFormatted(
-    char *format,
-    ...)
-{
-    va_list ap;
-    char *buffer;
-
-    va_start(ap, format);
-    buffer = utVsprintf(format, ap);
-    va_end(ap);
-    addString(buffer);
-}
-
 // Print out the value.
 void vaPrintValue(
     vaValue value)
 {
-    uchar *string = vaValue2String(value);
+    vaSink sink = vaFileSinkCreate(stdout);
 
-    printf("%s", string);
+    vaWriteValue(sink, value, 0, false);
+    vaSinkFlush(sink);
+    vaSinkDestroy(sink);
 }
 
-// Forward declaration for recursion.
-static void addValue(vaValue value);
-
-// Add a tuple to the string buffer.
-static void addTupple(
-    vaList list)
+// Write the value to the text sink, and return the zero-terminated text.
+static uchar *value2String(
+    vaValue value,
+    bool hexFloats)
 {
-    vaValue value;
-    bool firstTime = true;
+    uint64 length;
 
-    addChar('(');
-    vaForeachListValue(list, value) {
-        if(!firstTime) {
-            addString(", ");
-        }
-        firstTime = false;
-        addValue(value);
-    } vaEndListValue;
-    addChar(')');
+    vaSinkClear(vaTextSink);
+    vaWriteValue(vaTextSink, value, 0, hexFloats);
+    vaSinkAddByte(vaTextSink, '\0');
+    return vaSinkGetBytes(vaTextSink, &length);
 }
 
-// Add a list of values to the string buffer.
-static void addList(
-    vaList list)
+// Convert the value to a string.  This returns a static buffer, which is overwritten on the
+// next call.
+uchar *vaValue2String(
+    vaValue value)
 {
-    vaValue value;
-    bool firstTime = true;
+    return value2String(value, false);
+}
 
-    addChar('[');
-    vaForeachListValue(list, value) {
-        if(!firstTime) {
-            addString(", ");
-        }
-        firstTime = false;
-        addValue(value);
-    } vaEndListValue;
-    addChar(']');
+// Convert the value to a string, but use hex format for floats.  This allows values to be
+// parsed without rouding errors.
+uchar *vaValue2PreciseString(
+    vaValue value)
+{
+    return value2String(value, true);
 }
 
-// Add a dictionary to the string buffer.
-static void addDictionary(
-    vaDictionary dictionary)
+// Return true if two equal values are also identical, so one can stand for the other.
+// Equality treats 0.0 and -0.0 as equal, but sharing must keep the sign.
+static bool valuesIdentical(
+    vaValue value1,
+    vaValue value2)
 {
-    vaDictEntry dictEntry;
-    bool firstTime = true;
+    vaList list1, list2;
+    uint32 xValue;
+    float float1, float2;
+    double double1, double2;
 
-    addString("<|");
-    vaForeachDictionaryDictEntry(dictionary, dictEntry) {
-        if(!firstTime) {
-            addString(", ");
+    if(value1 == value2) {
+        return true;
+    }
+    switch(vaValueGetType(value1)) {
+    case VA_FLOAT:
+        float1 = vaValueGetFloatVal(value1);
+        float2 = vaValueGetFloatVal(value2);
+        return !memcmp(&float1, &float2, sizeof(float));
+    case VA_DOUBLE:
+        double1 = vaValueGetDoubleVal(value1);
+        double2 = vaValueGetDoubleVal(value2);
+        return !memcmp(&double1, &double2, sizeof(double));
+    case VA_TUPLE: case VA_LIST:
+        list1 = vaValueGetType(value1) == VA_TUPLE? vaValueGetTupleVal(value1) :
+            vaValueGetListVal(value1);
+        list2 = vaValueGetType(value2) == VA_TUPLE? vaValueGetTupleVal(value2) :
+            vaValueGetListVal(value2);
+        for(xValue = 0; xValue < vaListGetUsedValue(list1); xValue++) {
+            if(!valuesIdentical(vaListGetiValue(list1, xValue),
+                    vaListGetiValue(list2, xValue))) {
+                return false;
+            }
         }
-        firstTime = false;
-        addValue(vaDictEntryGetKey(dictEntry));
-        addChar(':');
-        addValue(vaDictEntryGetValue(dictEntry));
-    } vaEndDictionaryDictEntry;
-    addString("|>");
+        return true;
+    default:
+        return true;
+    }
 }
 
-// Add the blob to the string buffer.
-static void addBlob(
-    vaBlob blob)
+// Return the shared value equal to the new one when hash-consing, and destroy the new one.
+// Parts of the new value already owned by the shared one are detached first.  Tuples and
+// lists holding a dictionary are not shared, since that would alias the dictionary, and
+// neither are values only equal to a shared one, like -0.0 and 0.0.
+static vaValue consValue(
+    vaValue value)
 {
-    uint64 length = vaBlobGetLength(blob);
-    uint8 *bytes = vaBlobGetValue(blob);
-    uint8 value;
+    vaValue oldValue;
 
-    addString("0b");
-    while(length--) {
-        value = *bytes++;
-        addChar(toHex(value >> 4));
-        addChar(toHex(value & 0xf));
+    if(!vaHashConsing) {
+        return value;
     }
-}
-
-union doubleToUint64Union {
-    double doubleVal;
-    uint64 uint64Val; 
-};
-
-// Add a double to the string buffer.  We assume standard IEEE format.
-static void addDouble(
-    double value)
-{
-    union doubleToUint64Union u;
-    int32 exponent;
-    uint64 intVal, fraction;
-    uint8 sign;
-
-    if(vaUseHexFloats) {
-        u.doubleVal = value;
-        intVal = u.uint64Val;
-        fraction = intVal & 0xfffffffffffffllu;
-        while(fraction && ((fraction & 0xf) == 0)) {
-            // Remove trailing 0's
-            fraction >>= 4;
-        }
-        exponent = ((intVal >> 52) & 0x7ff) - 1023;
-        sign = intVal >> 63;
-        if(sign == 1) {
-            addChar('-');
-        }
-        addFormatted("0x1.%llXp%d", fraction, exponent);
-    } else {
-        addFormatted("%g", value);
+    // Hashing first also tells if the value holds a dictionary.
+    vaValueHash(value);
+    if(!vaValueHashStable(value)) {
+        return value;
+    }
+    oldValue = vaDictionaryFindValue(vaConsTable, value);
+    if(oldValue != vaValueNull && !valuesIdentical(oldValue, value)) {
+        return value;
     }
+    if(oldValue == vaValueNull) {
+        vaDictionaryInsertValue(vaConsTable, value, value);
+        return value;
+    }
+    switch(vaValueGetType(value)) {
+    case VA_STRING: vaValueSetStringVal(value, vaStringNull); break;
+    case VA_TUPLE: vaListSetUsedValue(vaValueGetTupleVal(value), 0); break;
+    case VA_LIST: vaListSetUsedValue(vaValueGetListVal(value), 0); break;
+    default:
+        break;
+    }
+    vaValueDestroy(value);
+    return oldValue;
 }
 
-union floatToUint32Union {
-    float floatVal;
-    uint32 uint32Val; 
-};
-
-// Add a float to the string buffer.  We assume standard IEEE format.
-static void addFloat(
-    float value)
-{
-    union floatToUint32Union u;
-    int32 exponent;
-    uint32 intVal, fraction;
-    uint8 sign;
-
-    if(vaUseHexFloats) {
-        u.floatVal = value;
-        intVal = u.uint32Val;
-        fraction = (intVal & 0x7fffffu) << 1;
-        while(fraction && ((fraction & 0xf) == 0)) {
-            // Remove trailing 0's
-            fraction >>= 4;
-        }
-        exponent = ((intVal >> 23) & 0xff) - 127;
-        sign = intVal >> 31;
-        if(sign == 1) {
-            addChar('-');
-        }
-        addFormatted("0x1.%Xp%d", fraction, exponent);
-    } else {
-        addFormatted("%g", value);
+// Turn hash-consing on or off.  While on, equal scalars, tuples, lists and blobs share one
+// value object, so values must not be modified or destroyed once created.  Dictionaries, and
+// tuples and lists holding them, are not shared.
+void vaSetHashConsing(
+    bool value)
+{
+    vaHashConsing = value;
+    if(value && vaConsTable == vaDictionaryNull) {
+        vaConsTable = vaDictionaryCreate();
     }
 }
 
-// Convert the value to a string.
-static void addValue(
+// Return true if the value is shared, and so must not be destroyed.
+static bool valueShared(
     vaValue value)
 {
     switch(vaValueGetType(value)) {
-    case VA_POSINT:
-        addFormatted("%llu", vaValueGetUintVal(value));
-        break;
-    case VA_NEGINT:
-        addFormatted("-%llu", vaValueGetUintVal(value));
-        break;
-    case VA_OBJECT:
-        addFormatted("0p%llx", vaValueGetObjectVal(value));
-        break;
-    case VA_FLOAT:
-        addFloat(vaValueGetFloatVal(value));
-        break;
-    case VA_DOUBLE:
-        addDouble(vaValueGetDoubleVal(value));
-        break;
-    case VA_STRING:
-        addString((char *)vaMungeString(vaStringGetValue(vaValueGetStringVal(value))));
-        break;
-    case VA_BOOL:
-        if(vaValueBoolVal(value)) {
-            addString("true");
-        } else {
-            addString("false");
+    case VA_BOOL: case VA_NULL:
+        return true;
+    case VA_POSINT: case VA_NEGINT:
+        if(vaValueGetUintVal(value) < VA_NUM_SMALL_INTS) {
+            return true;
         }
         break;
-    case VA_IDENT:
-        addString((char *)vaEscapeIdent((uchar *)utSymGetName(vaValueGetNameVal(value))));
-        break;
-    case VA_TUPLE:
-        addTupple(vaValueGetTupleVal(value));
-        break;
-    case VA_LIST:
-        addList(vaValueGetListVal(value));
-        break;
-    case VA_NULL:
-        addString("null");
-        break;
     case VA_DICTIONARY:
-        addDictionary(vaValueGetDictionaryVal(value));
-        break;
-    case VA_BLOB:
-        addBlob(vaValueGetBlobVal(value));
-        break;
+        return false;
     default:
-        utExit("Unknown value type");
+        break;
     }
+    return vaHashConsing && vaDictionaryFindValue(vaConsTable, value) == value;
 }
 
-// Convert the value to a string.
-uchar *vaValue2String(
+// Destroy the value and the values in it, skipping any that are shared.  Strings are
+// interned, so they are kept.  Use this rather than vaValueDestroy on values that may
+// contain shared ones, such as decoded values.
+void vaValueDestroyUnshared(
     vaValue value)
 {
-    vaUseHexFloats = false;
-    vaStringPos = 0;
-    addValue(value);
-    addChar('\0');
-    return vaStringBuffer;
-}
+    vaDictionary dictionary;
+    vaList list;
+    vaValue child;
+    uint32 xEntry;
 
-// Convert the value to a string, but use hex format for floats.  This allows values to be
-// parsed without rouding errors.
-uchar *vaValue2PreciseString(
-    vaValue value)
-{
-    vaUseHexFloats = true;
-    vaStringPos = 0;
-    addValue(value);
-    addChar('\0');
-    return vaStringBuffer;
+    if(valueShared(value)) {
+        return;
+    }
+    switch(vaValueGetType(value)) {
+    case VA_STRING:
+        vaValueSetStringVal(value, vaStringNull);
+        break;
+    case VA_TUPLE: case VA_LIST:
+        list = vaValueGetType(value) == VA_TUPLE? vaValueGetTupleVal(value) :
+            vaValueGetListVal(value);
+        vaForeachListValue(list, child) {
+            vaValueDestroyUnshared(child);
+        } vaEndListValue;
+        // The children are gone, so keep the cascade from destroying them again.
+        vaListSetUsedValue(list, 0);
+        break;
+    case VA_DICTIONARY:
+        dictionary = vaValueGetDictionaryVal(value);
+        vaForeachDictionaryEntry(dictionary, xEntry) {
+            vaValueDestroyUnshared(vaDictionaryGetiKey(dictionary, xEntry));
+            vaValueDestroyUnshared(vaDictionaryGetiValue(dictionary, xEntry));
+        } vaEndDictionaryEntry;
+        break;
+    default:
+        break;
+    }
+    vaValueDestroy(value);
 }
 
 // Create a raw value object.
@@ -327,24 +241,48 @@ static inline vaValue valueCreate(
     return value;
 }
 
+// Return the shared value for a small integer, creating it on first use.
+static vaValue smallIntValue(
+    vaType type,
+    uint64 val)
+{
+    vaValue *values = type == VA_POSINT? vaSmallPosInts : vaSmallNegInts;
+    vaValue value = values[val];
+
+    if(value == vaValueNull) {
+        value = valueCreate(type);
+        vaValueSetUintVal(value, val);
+        values[val] = value;
+    }
+    return value;
+}
+
 // Create a positive integer value.
 vaValue vaPosIntValueCreate(
     uint64 val)
 {
-    vaValue value = valueCreate(VA_POSINT);
+    vaValue value;
 
+    if(val < VA_NUM_SMALL_INTS) {
+        return smallIntValue(VA_POSINT, val);
+    }
+    value = valueCreate(VA_POSINT);
     vaValueSetUintVal(value, val);
-    return value;
+    return consValue(value);
 }
 
 // Create a negative integer value.
 vaValue vaNegIntValueCreate(
     uint64 val)
 {
-    vaValue value = valueCreate(VA_NEGINT);
+    vaValue value;
 
+    if(val < VA_NUM_SMALL_INTS) {
+        return smallIntValue(VA_NEGINT, val);
+    }
+    value = valueCreate(VA_NEGINT);
     vaValueSetUintVal(value, val);
-    return value;
+    return consValue(value);
 }
 
 
@@ -352,26 +290,17 @@ vaValue vaNegIntValueCreate(
 vaValue vaIntValueCreate(
     int64 val)
 {
-    vaValue value;
-
     if(val >= 0) {
-        value = valueCreate(VA_POSINT);
-        vaValueSetUintVal(value, val);
-    } else {
-        value = valueCreate(VA_NEGINT);
-        vaValueSetUintVal(value, -val);
+        return vaPosIntValueCreate(val);
     }
-    return value;
+    return vaNegIntValueCreate(-(uint64)val);
 }
 
 // Create an unsigned integer value.
 vaValue vaUintValueCreate(
     int64 val)
 {
-    vaValue value = valueCreate(VA_POSINT);
-
-    vaValueSetUintVal(value, val);
-    return value;
+    return vaPosIntValueCreate(val);
 }
 
 // Create an object reference value.
@@ -381,7 +310,7 @@ vaValue vaObjectValueCreate(
     vaValue value = valueCreate(VA_OBJECT);
 
     vaValueSetObjectVal(value, val);
-    return value;
+    return consValue(value);
 }
 
 // Create a string value.
@@ -391,7 +320,7 @@ vaValue vaStringValueCreate(
     vaValue value = valueCreate(VA_STRING);
 
     vaValueSetStringVal(value, string);
-    return value;
+    return consValue(value);
 }
 
 // Create a floating point value.
@@ -401,7 +330,7 @@ vaValue vaFloatValueCreate(
     vaValue value = valueCreate(VA_FLOAT);
 
     vaValueSetFloatVal(value, val);
-    return value;
+    return consValue(value);
 }
 
 // Create a double precision floating point value.
@@ -411,17 +340,20 @@ vaValue vaDoubleValueCreate(
     vaValue value = valueCreate(VA_DOUBLE);
 
     vaValueSetDoubleVal(value, val);
-    return value;
+    return consValue(value);
 }
 
-// Create a Boolean point value.
+// Create a Boolean point value.  There is only one true and one false value.
 vaValue vaBoolValueCreate(
     bool val)
 {
-    vaValue value = valueCreate(VA_BOOL);
+    vaValue *valuePtr = val? &vaTrueValue : &vaFalseValue;
 
-    vaValueSetBoolVal(value, val);
-    return value;
+    if(*valuePtr == vaValueNull) {
+        *valuePtr = valueCreate(VA_BOOL);
+        vaValueSetBoolVal(*valuePtr, val);
+    }
+    return *valuePtr;
 }
 
 // Create an entry value.
@@ -431,7 +363,7 @@ vaValue vaIdentValueCreate(
     vaValue value = valueCreate(VA_IDENT);
 
     vaValueSetNameVal(value, val);
-    return value;
+    return consValue(value);
 }
 
 // Create a tuple value from a list of values.
@@ -441,7 +373,7 @@ vaValue vaTupleValueCreate(
     vaValue value = valueCreate(VA_TUPLE);
 
     vaValueSetTupleVal(value, vals);
-    return value;
+    return consValue(value);
 }
 
 // Create a list value from a list of values.
@@ -451,7 +383,7 @@ vaValue vaListValueCreate(
     vaValue value = valueCreate(VA_LIST);
 
     vaValueSetListVal(value, vals);
-    return value;
+    return consValue(value);
 }
 
 // Create a dictionary value from a list of values.
@@ -464,10 +396,13 @@ vaValue vaDictionaryValueCreate(
     return value;
 }
 
-// Create a null value.
+// Create a null value.  There is only one.
 vaValue vaNullValueCreate(void)
 {
-    return valueCreate(VA_NULL);
+    if(vaNullValue == vaValueNull) {
+        vaNullValue = valueCreate(VA_NULL);
+    }
+    return vaNullValue;
 }
 
 // Create a binary blob value.
@@ -477,15 +412,18 @@ vaValue vaBlobValueCreate(
     vaValue value = valueCreate(VA_BLOB);
 
     vaValueSetBlobVal(value, blob);
-    return value;
+    return consValue(value);
 }
 
 // Determine if two values are equal.  For lists, tupples, and dictionaries, we have to compare
-// sub-values.
+// sub-values, unless their cached hashes already differ.
 bool vaValuesEqual(
     vaValue value1,
     vaValue value2)
 {
+    if(value1 == value2) {
+        return true;
+    }
     if(vaValueGetType(value1) != vaValueGetType(value2)) {
         return false;
     }
@@ -512,400 +450,72 @@ bool vaValuesEqual(
     return false; // Dummy return
 }
 
-// Skip white space.
-static void skipSpace(
-    uchar **bytesPtr)
+// Hash the bits of a 64-bit value.
+static inline uint32 hashUint64(
+    uint32 hash,
+    uint64 value)
 {
-    uchar *bytes = *bytesPtr;
-
-    while(*bytes != '\0' && *bytes <= ' ') {
-        bytes++;
-    }
-    *bytesPtr = bytes;
+    return utHashValues(utHashValues(hash, (uint32)value), (uint32)(value >> 32));
 }
 
-// Forward declaraction for recursion.
-static vaValue parseValue(uchar **bytesPtr);
-
-// Parse a list, but don't convert it to a value.
-static vaList parseGenericList(
-    uchar **bytesPtr,
-    char lastChar)
-{
-    vaList list = vaListCreate();
-    vaValue value;
-    uchar c;
-
-    (*bytesPtr)++;
-    skipSpace(bytesPtr);
-    c = **bytesPtr;
-    while(c != lastChar) {
-        value = parseValue(bytesPtr);
-        vaListAppendValue(list, value);
-        skipSpace(bytesPtr);
-        c = **bytesPtr;
-        if(c == ',') {
-            (*bytesPtr)++;
-        } else if(c != lastChar) {
-            utExit("Expected %c to end list: %s", lastChar, *bytesPtr);
-        }
-    }
-    (*bytesPtr)++;
-    return list;
-}
-
-// Parse a list value.
-static vaValue parseList(
-    uchar **bytesPtr)
-{
-    vaList list = parseGenericList(bytesPtr, ']');
-
-    return vaListValueCreate(list);
-}
-
-// Parse a tuple value.
-static vaValue parseTuple(
-    uchar **bytesPtr)
-{
-    vaList list = parseGenericList(bytesPtr, ')');
-
-    return vaTupleValueCreate(list);
-}
-
-// Parse a dictionary value.
-static vaValue parseDictionary(
-    uchar **bytesPtr)
-{
-    vaDictionary dictionary = vaDictionaryCreate();
-    vaValue key, value;
-    uchar c;
-
-    (*bytesPtr) += 2;
-    skipSpace(bytesPtr);
-    c = **bytesPtr;
-    while(c != '|' || (*bytesPtr)[1] != '>') {
-        key = parseValue(bytesPtr);
-        skipSpace(bytesPtr);
-        c = **bytesPtr;
-        if(c != ':') {
-            utExit("Expected a key:value pair: ", *bytesPtr);
-        }
-        (*bytesPtr)++;
-        value = parseValue(bytesPtr);
-        vaDictionaryInsertValue(dictionary, key, value);
-        skipSpace(bytesPtr);
-        c = **bytesPtr;
-        if(c == ',') {
-            (*bytesPtr)++;
-        } else if(c != '|' || (*bytesPtr)[1] != '>') {
-            utExit("Expected |> to end dictionary: %s", *bytesPtr);
-        }
-    }
-    (*bytesPtr) += 2;
-    return vaDictionaryValueCreate(dictionary);
-}
-
-// Add an escaped character to the string buffer.  Only 0 is not allowed.
-static void addEscapedChar(
-    uchar **bytesPtr)
-{
-    uchar c = **bytesPtr;
-
-    if(c == 'n') {
-        addChar('\n');
-        (*bytesPtr)++;
-    } else if(c == 'r') {
-        addChar('\r');
-        (*bytesPtr)++;
-    } else if(c == 't') {
-        addChar('\t');
-        (*bytesPtr)++;
-    } else if(c == '\0') {
-        utExit("Invalid zero embedded in string.");
-    } else {
-        addUtf8Char(bytesPtr);
-    }
-}
-
-// Parse a string.
-static vaValue parseString(
-    uchar **bytesPtr)
-{
-    uchar *bytes = *bytesPtr + 1;
-    uchar c = *bytes;
-
-    vaStringPos = 0;
-    while(c != '"') {
-        if(c == '\0') {
-            utExit("Unterminated string");
-        }
-        if(c == '\\') {
-            bytes++;
-            addEscapedChar(&bytes);
-        } else {
-            addUtf8Char(&bytes);
-        }
-        c = *bytes;
-    }
-    addChar('\0');
-    *bytesPtr = bytes + 1;
-    return vaStringValueCreate(vaStringCreate(vaStringBuffer));
-}
-
-// Convert a hex character into a value.  If not a valid hex character, return 255.
-static uint8 fromHex(
-    uchar c)
-{
-    if(isdigit(c)) {
-        return c - '0';
-    }
-    if(c >= 'a' && c <= 'f') {
-        return 10 + c - 'a';
-    }
-    if(c >= 'A' && c <= 'F') {
-        return 10 + c - 'A';
-    }
-    return 255;
-}
-
-// Parse a hex integer or object reference.
-static vaValue parseHexNumber(
-    uchar **bytesPtr)
-{
-    uchar type = *(*bytesPtr + 1);
-    uchar *bytes = *bytesPtr + 2;
-    uint64 value = 0;
-    uchar c = *bytes++;
-    uint8 digit;
-
-    while(true) {
-        digit = fromHex(c);
-        if(digit == 255) {
-            if(type == 'p') {
-                *bytesPtr = bytes - 1;
-                return vaObjectValueCreate(value);
-            }
-            utAssert(type == 'x');
-            *bytesPtr = bytes - 1;
-            return vaPosIntValueCreate(value);
-        }
-        value = (value << 4) | digit;
-        c = *bytes++;
-    }
-    return vaValueNull; // Dummy return
-}
-
-// Parse a blob string.
-static vaValue parseBlob(
-    uchar **bytesPtr)
-{
-    uchar type = *(*bytesPtr + 1);
-    uchar *bytes = *bytesPtr + 2;
-    uchar c = *bytes++;
-    uint8 digit1, digit2;
-
-    vaStringPos = 0;
-    while(true) {
-        digit1 = fromHex(c);
-        if(digit1 >= 16) {
-            *bytesPtr = bytes - 1;
-            if(type == 'b') {
-                return vaBlobValueCreate(vaBlobCreate(vaStringPos, vaStringBuffer));
-            }
-            if(type == 'f') {
-                return vaFloatValueCreate(vaDecodeFloat(vaStringBuffer));
-            }
-            utAssert(type == 'd');
-            return vaFloatValueCreate(vaDecodeDouble(vaStringBuffer));
-        }
-        c = *bytes++;
-        digit2 = fromHex(c);
-        if(digit1 >= 16) {
-            utExit("Expecting an even number of hex digits in blob: %s", *bytesPtr);
-        }
-        addChar((digit1 << 4) | digit2);
-        c = *bytes++;
-    }
-    return vaValueNull; // Dummy return
-}
-
-// Parse a + or - sign, and return true if negating.
-static bool parseSign(
-    uchar **bytesPtr)
-{
-    uchar c = **bytesPtr;
-    bool negate = false;
-
-    if(c == '-') {
-        negate = true;
-        (*bytesPtr)++;
-        skipSpace(bytesPtr);
-    }
-    if(c == '+') {
-        (*bytesPtr)++;
-        skipSpace(bytesPtr);
-    }
-    return negate;
-}
-
-// Parse an integer value.  Return vaValueNull rather than failing if not a valid int.
-static vaValue parseInt(
-    uchar **bytesPtr)
-{
-    bool negate = parseSign(bytesPtr);
-    uchar *bytes = *bytesPtr;
-    uchar c = *bytes++;
-    uint64 value = 0;
-
-    if(!isdigit(c)) {
-        utExit("Invalid integer: %s", *bytesPtr);
-    }
-    do {
-        value = 10*value + c - '0';
-        c = *bytes++;
-    } while(isdigit(c));
-    *bytesPtr = bytes - 1;
-    if(negate) {
-        return vaNegIntValueCreate(value);
-    }
-    return vaPosIntValueCreate(value);
-}
-
-// Parse a floating point number.
-static vaValue parseFloat(
-    uchar **bytesPtr)
-{
-    char *tail;
-    double value = strtod((char *)(*bytesPtr), &tail);
-    float floatVal = value;
-
-    *bytesPtr = (uchar *)(tail);
-    if(floatVal == value) {
-        return vaFloatValueCreate(floatVal);
-    }
-    return vaDoubleValueCreate(value);
-}
-
-// Parse an identifier.
-static vaValue parseIdent(
-    uchar **bytesPtr)
-{
-    uchar *bytes = *bytesPtr;
-    uchar c = *bytes;
-    bool hasEscape = false;
-
-    if(c != '\\' && c != '_' && !isalpha(c)) {
-        utExit("Invalid identifier: %s", bytes);
-    }
-    vaStringPos = 0;
-    while(c == '\\' || c == '_' || isalnum(c)) {
-        if(c == '\\') {
-            bytes++;
-            addEscapedChar(&bytes);
-            hasEscape = true;
-        } else {
-            addUtf8Char(&bytes);
-        }
-        c = *bytes;
-    }
-    addChar('\0');
-    *bytesPtr = bytes;
-    if(!hasEscape) {
-        if(!strcmp((char *)vaStringBuffer, "true")) {
-            return vaBoolValueCreate(true);
-        }
-        if(!strcmp((char *)vaStringBuffer, "false")) {
-            return vaBoolValueCreate(false);
-        }
-        if(!strcmp((char *)vaStringBuffer, "null")) {
-            return vaNullValueCreate();
-        }
-    }
-    return vaIdentValueCreate(utSymCreate((char *)vaStringBuffer));
-}
-
-// Determine if the string has what looks like a floating point value.
-static bool isFloat(
-    uchar *bytes)
-{
-    uchar c = *bytes++;
-
-    if(c == '-') {
-        skipSpace(&bytes);
-        c = *bytes++;
-    }
-    if(c == '0' && *bytes == 'x') {
-        // Could be hex coded float.  Is there a . or p?
-        bytes++;
-        c = *bytes++;
-        while(c != '\0' && c != '.' && c != 'p' && c != 'P') {
-            if(!isdigit(c) && (c < 'a' || c > 'f') && (c < 'A' || c > 'F')) {
-                return false;
-            }
-            c = *bytes++;
-        }
-        return c != '\0';
-    }
-    while(c != '\0' && c != '.' && c != 'e' && c != 'E') {
-        if(!isdigit(c)) {
-            return false;
-        }
-        c = *bytes++;
-    }
-    return c != '\0';
-}
-
-// This is a custom high-speed value parser.
-static vaValue parseValue(
-    uchar **bytesPtr)
+// Compute a structural hash of the value, consistent with vaValuesEqual.  Hashes of
+// aggregates are cached, so rehashing a value is cheap.
+uint32 vaValueHash(
+    vaValue value)
 {
-    uchar *bytes;
-    uchar c, d;
+    vaType type = vaValueGetType(value);
+    uint32 hash = type;
+    double doubleVal;
+    float floatVal;
+    uint64 doubleBits;
+    uint32 floatBits;
 
-    skipSpace(bytesPtr);
-    bytes = *bytesPtr;
-    c = **bytesPtr;
-    if(isFloat(bytes)) {
-        return parseFloat(bytesPtr);
-    }
-    switch(c) {
-    case '\0': utExit("Unexpected end of value expression"); return vaValueNull;
-    case '[':
-        return parseList(bytesPtr);
-    case '<':
-        if(bytes[1] == '|') {
-            return parseDictionary(bytesPtr);
-        }
-        break;
-    case '(': return parseTuple(bytesPtr);
-    case '"': return parseString(bytesPtr);
-    case '0':
-        d = bytes[1];
-        if(d == 'p' || d == 'x') {
-            return parseHexNumber(bytesPtr);
+    switch(type) {
+    case VA_POSINT: case VA_NEGINT: return hashUint64(hash, vaValueGetUintVal(value));
+    case VA_OBJECT: return hashUint64(hash, vaValueGetObjectVal(value));
+    case VA_FLOAT:
+        // 0.0 and -0.0 are equal, so they must hash the same.
+        floatVal = vaValueGetFloatVal(value);
+        floatBits = 0;
+        if(floatVal != 0.0f) {
+            memcpy(&floatBits, &floatVal, sizeof(float));
         }
-        if(d == 'f' || d == 'd' || d == 'b') {
-            return parseBlob(bytesPtr);
+        return utHashValues(hash, floatBits);
+    case VA_DOUBLE:
+        doubleVal = vaValueGetDoubleVal(value);
+        doubleBits = 0;
+        if(doubleVal != 0.0) {
+            memcpy(&doubleBits, &doubleVal, sizeof(double));
         }
-        break;
-    }
-    if(isdigit(c) || c == '-' || c == '+') {
-        // Must be an integer
-        return parseInt(bytesPtr);
+        return hashUint64(hash, doubleBits);
+    case VA_STRING:
+        // Strings are unique, so the object identifies the text.
+        return utHashValues(hash, vaString2Index(vaValueGetStringVal(value)));
+    case VA_BOOL: return utHashValues(hash, vaValueBoolVal(value));
+    case VA_IDENT: return utHashValues(hash, utSym2Index(vaValueGetNameVal(value)));
+    case VA_TUPLE: return utHashValues(hash, vaListHash(vaValueGetTupleVal(value)));
+    case VA_LIST: return utHashValues(hash, vaListHash(vaValueGetListVal(value)));
+    case VA_NULL: return hash;
+    case VA_DICTIONARY:
+        return utHashValues(hash, vaDictionaryHash(vaValueGetDictionaryVal(value)));
+    case VA_BLOB: return utHashValues(hash, vaBlobHash(vaValueGetBlobVal(value)));
+    default:
+        utExit("Unknown value type");
     }
-    bytes = *bytesPtr;
-    // Should only have IDENT left.
-    return parseIdent(bytesPtr);
+    return 0; // Dummy return
 }
 
-// This is a custom high-speed value parser.
-vaValue vaParseValue(
-    uchar *bytes)
+// Return true if the value's hash can't change, so an aggregate holding it may cache its own
+// hash.  Call this after hashing the value.  Dictionaries change as entries are inserted and
+// removed, so tuples and lists holding one, however deeply, are not cached.
+bool vaValueHashStable(
+    vaValue value)
 {
-    vaValue value = parseValue(&bytes);
-
-    if(*bytes != '\0') {
-        utExit("Extra bytes at end of value: %s", bytes);
+    switch(vaValueGetType(value)) {
+    case VA_DICTIONARY: return false;
+    case VA_TUPLE: return vaListGetHash(vaValueGetTupleVal(value)) != 0;
+    case VA_LIST: return vaListGetHash(vaValueGetListVal(value)) != 0;
+    default:
+        return true;
     }
-    return value;
 }
@@ -1,6 +1,11 @@
+#include <sys/uio.h>
 #include "vadatabase.h"
+#include "thread.h"
 
-// Value methods.
+// Value methods.  Functions that return text or encodings in a shared buffer, such as
+// vaValue2String and vaBencode, are for one thread only.  Other threads should use the sink
+// functions, which keep their state in the sink and on the stack.  Creating values allocates
+// from shared tables, so only one thread at a time may create, parse or decode values.
 void vaValueStart(void);
 void vaValueStop(void);
 vaValue vaIntValueCreate(int64 val);
@@ -19,36 +24,147 @@ vaValue vaDictionaryValueCreate(vaDictionary dictionary);
 vaValue vaNullValueCreate(void);
 vaValue vaBlobValueCreate(vaBlob blob);
 bool vaValuesEqual(vaValue value1, vaValue value2);
+uint32 vaValueHash(vaValue value);
+bool vaValueHashStable(vaValue value);
 void vaPrintValue(vaValue value);
 uint8 *vaValue2String(vaValue value);
 uint8 *vaValue2PreciseString(vaValue value);
-vaValue vaParseValue(uchar *string);
+vaValue vaParseValue(uchar *text);
+vaValue vaTryParseValue(uchar *text, char **message, uint64 *offset);
+void vaSetHashConsing(bool value);
+void vaValueDestroyUnshared(vaValue value);
+void vaSetParseThreads(uint32 numThreads);
 
 // List methods
 bool vaListsEqual(vaList list1, vaList list2);
+uint32 vaListHash(vaList list);
 static inline vaList vaListCreate(void) {return vaListAlloc();}
 
 // Dictionary methods
 bool vaDictionariesEqual(vaDictionary dict1, vaDictionary dict2);
+uint32 vaDictionaryHash(vaDictionary dictionary);
 vaDictionary vaDictionaryCreate(void);
+void vaDictionaryReserve(vaDictionary dictionary, uint32 numEntries);
 void vaDictionaryInsertValue(vaDictionary dictionary, vaValue key, vaValue value);
+vaValue vaDictionaryFindValue(vaDictionary dictionary, vaValue key);
+bool vaDictionaryRemoveValue(vaDictionary dictionary, vaValue key);
+
+// Iterate over the entries of a dictionary in insertion order, skipping deleted ones.
+#define vaForeachDictionaryEntry(dictionary, xEntry) \
+    for(xEntry = 0; xEntry < vaDictionaryGetUsedEntries(dictionary); xEntry++) { \
+        if(vaDictionaryGetiKey(dictionary, xEntry) != vaValueNull) {
+#define vaEndDictionaryEntry }}
+
+// Regions are reference-counted bytes that blobs can borrow without copying.
+typedef struct vaRegionStruct *vaRegion;
+typedef void (*vaRegionReleaseFunc)(void *context, uint8 *bytes, uint64 length);
+
+vaRegion vaRegionCreate(uint8 *bytes, uint64 length, vaRegionReleaseFunc release, void *context);
+vaRegion vaMallocRegionCreate(uint8 *bytes, uint64 length);
+vaRegion vaFileRegionCreate(char *fileName);
+void vaRegionRef(vaRegion region);
+void vaRegionUnref(vaRegion region);
+uint8 *vaRegionGetBytes(vaRegion region, uint64 *length);
 
 // Blob methods
 vaBlob vaBlobCreate(uint64 length, uint8 *bytes);
+vaBlob vaBlobCreateFromHex(uchar *text, uint64 length);
+vaBlob vaBlobCreateBorrowed(vaRegion region, uint8 *bytes, uint64 length);
 void vaFreeBlobData(vaBlob blob);
 bool vaBlobsEqual(vaBlob blob1, vaBlob blob2);
+uint32 vaBlobHash(vaBlob blob);
+uchar *vaSkipHexDigits(uchar *text);
+void vaHexDecode(uchar *text, uint8 *bytes, uint64 length);
+void vaHexEncode(uint8 *bytes, uint64 length, uchar *text);
 
 // String methods
 vaString vaStringCreate(uchar *value);
 vaString vaStrcat(vaString string1, vaString string2);
 
+// Float formatting.  Buffers must hold VA_MAX_FLOAT_TEXT bytes.
+#define VA_MAX_FLOAT_TEXT 32
+uint32 vaFormatDouble(double value, char *buffer);
+uint32 vaFormatFloat(float value, char *buffer);
+uint32 vaFormatHexDouble(double value, char *buffer);
+uint32 vaFormatHexFloat(float value, char *buffer);
+
+// 64-bit XXH64 content hashes.  Bytes can be added in pieces.  The struct is public so
+// hashers can live on the stack.
+#define VA_HASH_STRIPE 32
+typedef struct {
+    uint64 accumulators[4];
+    uint64 seed, length;
+    uint8 stripe[VA_HASH_STRIPE]; // Bytes not yet mixed in
+    uint32 used;
+} vaHasher;
+
+void vaHasherStart(vaHasher *hasher, uint64 seed);
+void vaHasherAdd(vaHasher *hasher, uint8 *bytes, uint64 length);
+uint64 vaHasherFinish(vaHasher *hasher);
+uint64 vaHash64(uint8 *bytes, uint64 length);
+
+// Sinks buffer output, and pass it in chunks to a write function.  The struct is public so
+// bytes can be added inline.
+typedef bool (*vaSinkWriteFunc)(void *context, struct iovec *chunks, uint32 numChunks);
+typedef struct vaSinkStruct *vaSink;
+struct vaSinkStruct {
+    vaSinkWriteFunc write; // NULL for a memory sink
+    void *context;
+    uint8 *buffer;
+    uint64 size, used;
+    bool failed;
+};
+
+vaSink vaSinkCreate(vaSinkWriteFunc write, void *context);
+vaSink vaMemorySinkCreate(void);
+vaSink vaFdSinkCreate(int fd);
+vaSink vaFileSinkCreate(FILE *file);
+vaSink vaHashSinkCreate(vaHasher *hasher);
+void vaSinkDestroy(vaSink sink);
+bool vaSinkFlush(vaSink sink);
+void vaSinkMakeRoom(vaSink sink, uint64 length);
+void vaSinkWrite(vaSink sink, uint8 *bytes, uint64 length);
+uint8 *vaSinkGetBytes(vaSink sink, uint64 *length);
+void vaSinkClear(vaSink sink);
+static inline void vaSinkAddByte(vaSink sink, uint8 byte) {
+    if(sink->used == sink->size) {
+        vaSinkMakeRoom(sink, 1);
+    }
+    sink->buffer[sink->used++] = byte;
+}
+
+// Text writer
+void vaWriteValue(vaSink sink, vaValue value, uint32 indent, bool hexFloats);
+void vaWriteString(vaSink sink, uchar *string);
+void vaWriteIdent(vaSink sink, uchar *name);
+void vaWriteEncodedValue(vaSink sink, uint8 *bytes);
+
 // Bencode module
 void vaBencodeStart(void);
 void vaBencodeStop(void);
 vaValue vaBdecode(uchar *bytes);
+vaValue vaBdecodeLength(uchar *bytes, uint64 *length);
+vaValue vaBdecodeRegion(vaRegion region, uint8 *bytes);
+bool vaEncodingValid(uint8 *bytes, uint64 length, uint32 maxDepth);
 uchar *vaBencode(vaValue value, uint64 *length);
+uchar *vaBencode2(vaValue value, uint64 *length);
+void vaBencodeToSink(vaSink sink, vaValue value);
+void vaBencode2ToSink(vaSink sink, vaValue value);
+void vaBencodeCanonicalToSink(vaSink sink, vaValue value);
+uint64 vaCanonicalHash(vaValue value);
 uchar *vaBencodeUint(uint64 value);
+void vaBencodeAddValue(vaSink sink, vaValue value);
+void vaBencodeAddUint(vaSink sink, uint64 value);
+void vaBencodeAddBool(vaSink sink, bool value);
+void vaBencodeAddNull(vaSink sink);
+void vaBencodeAddString(vaSink sink, uchar *string);
+void vaBencodeAddIdent(vaSink sink, utSym sym);
+void vaBencodeStartTuple(vaSink sink);
+void vaBencodeStartList(vaSink sink);
+void vaBencodeEndList(vaSink sink);
 uint64 vaFindEncodedValueLength(uint8 *bytes);
+uint8 *vaFindEncodedElements(uint8 *bytes, uint8 **end, uint64 *count);
+uchar *vaFindEncodedText(uint8 *bytes);
 void vaPrintEncodedValue(uint8 *bytes);
 float vaDecodeFloat(uint8 *bytes);
 double vaDecodeDouble(uint8 *bytes);
@@ -57,6 +173,54 @@ void vaBencodeSelfTest(void);
 uchar *vaMungeString(uint8 *bytes);
 uchar *vaEscapeIdent(uint8 *bytes);
 
+// Push-mode decoder for values arriving in chunks.
+typedef struct vaDecoderStruct *vaDecoder;
+
+vaDecoder vaDecoderCreate(uint32 maxDepth);
+void vaDecoderDestroy(vaDecoder decoder);
+void vaDecoderPush(vaDecoder decoder, uint8 *bytes, uint64 length);
+vaValue vaDecoderNext(vaDecoder decoder);
+bool vaDecoderHasPartialValue(vaDecoder decoder);
+bool vaDecoderFailed(vaDecoder decoder);
+
+// Encoded value views read bencoded values in place.  A view with NULL bytes means not found,
+// or the end of a container.
+typedef struct {
+    uint8 *bytes;
+    uint8 *end; // End of the enclosing version 2 container, else NULL
+} vaEncodedView;
+
+vaEncodedView vaEncodedViewCreate(uint8 *bytes);
+static inline bool vaEncodedViewExists(vaEncodedView view) {return view.bytes != NULL;}
+vaType vaEncodedViewGetType(vaEncodedView view);
+uint64 vaEncodedViewGetLength(vaEncodedView view);
+vaEncodedView vaEncodedViewGetFirst(vaEncodedView view);
+vaEncodedView vaEncodedViewGetNext(vaEncodedView view);
+uint64 vaEncodedViewCountElements(vaEncodedView view);
+vaEncodedView vaEncodedViewGetiElement(vaEncodedView view, uint64 index);
+vaEncodedView vaEncodedViewFindKey(vaEncodedView view, uint8 *encodedKey);
+vaEncodedView vaEncodedViewFindString(vaEncodedView view, char *text);
+vaEncodedView vaEncodedViewFindIdent(vaEncodedView view, char *name);
+vaEncodedView vaEncodedQuery(vaEncodedView view, char *path);
+uint64 vaEncodedViewGetUint(vaEncodedView view);
+bool vaEncodedViewGetBool(vaEncodedView view);
+double vaEncodedViewGetDouble(vaEncodedView view);
+uchar *vaEncodedViewGetText(vaEncodedView view);
+uint8 *vaEncodedViewGetBlob(vaEncodedView view, uint64 *length);
+vaValue vaEncodedViewMaterialize(vaEncodedView view);
+
+// Iterate over the elements of an encoded tuple, list or dictionary.
+#define vaForeachEncodedViewElement(view, element) \
+    for(element = vaEncodedViewGetFirst(view); element.bytes != NULL; \
+            element = vaEncodedViewGetNext(element)) {
+#define vaEndEncodedViewElement }
+
+// Hashes are cached on aggregates as they are computed, and 0 means not yet computed.  Use
+// cached hashes to tell that two aggregates differ without comparing them.
+static inline bool vaHashesDiffer(uint32 hash1, uint32 hash2) {
+    return hash1 != 0 && hash2 != 0 && hash1 != hash2;
+}
+
 // Convert to a hex digit.
 static inline uchar toHex(uint8 value) { return value < 10? value + '0' : value - 10 + 'A'; }
 
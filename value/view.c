@@ -0,0 +1,354 @@
+/* Views of bencoded values.  A view points into an encoded buffer, and reads values in
+place.  Lists are indexed and dictionaries are searched by skipping over the encoded bytes
+of values that are not needed, so nothing is decoded or allocated until a vaValue is
+materialized.  The buffer must outlive its views.
+
+Paths such as [3].user or [0]["user name"] select values nested in tuples, lists and
+dictionaries.  A [number] indexes a tuple or list, a .name finds a string or ident key, and
+a ["text"] finds a string key, in which \" and \\ are escapes.  A leading . may be left out. */
+
+#include <ctype.h>
+#include "value.h"
+
+// Create a view of the encoded value.
+vaEncodedView vaEncodedViewCreate(
+    uint8 *bytes)
+{
+    vaEncodedView view;
+
+    view.bytes = bytes;
+    view.end = NULL;
+    return view;
+}
+
+// Create a view of an element, or a null view at the end of its container.
+static inline vaEncodedView createElementView(
+    uint8 *bytes,
+    uint8 *end)
+{
+    vaEncodedView view;
+
+    if(bytes == end || *bytes == 'E') {
+        bytes = NULL;
+    }
+    view.bytes = bytes;
+    view.end = end;
+    return view;
+}
+
+// Return the type of the viewed value.
+vaType vaEncodedViewGetType(
+    vaEncodedView view)
+{
+    uint8 type = *view.bytes;
+
+    if(type & 0x80) {
+        switch((type >> 3) & 0xf) {
+        case 0: return VA_POSINT;
+        case 1: return VA_NEGINT;
+        case 2: return VA_OBJECT;
+        case 3: return VA_BLOB;
+        default:
+            utExit("Invalid encoded value");
+        }
+    }
+    switch(type) {
+    case 'T': case 'F': return VA_BOOL;
+    case '0': return VA_NULL;
+    case 'f': return VA_FLOAT;
+    case 'g': return VA_DOUBLE;
+    case 's': case 'S': return VA_STRING;
+    case 'i': case 'I': return VA_IDENT;
+    case 't': case 'P': return VA_TUPLE;
+    case 'l': case 'L': return VA_LIST;
+    case 'd': case 'D': return VA_DICTIONARY;
+    default:
+        utExit("Invalid encoded value");
+    }
+    return VA_NULL; // Dummy return
+}
+
+// Return the number of bytes in the viewed value's encoding.
+uint64 vaEncodedViewGetLength(
+    vaEncodedView view)
+{
+    return vaFindEncodedValueLength(view.bytes);
+}
+
+// Return a view of the first element of a tuple, list or dictionary, or a null view if it
+// is empty.  Dictionary elements alternate between keys and values.
+vaEncodedView vaEncodedViewGetFirst(
+    vaEncodedView view)
+{
+    uint8 *end;
+    uint64 count;
+    uint8 *bytes = vaFindEncodedElements(view.bytes, &end, &count);
+
+    return createElementView(bytes, end);
+}
+
+// Return a view of the element after this one, or a null view at the end of the container.
+vaEncodedView vaEncodedViewGetNext(
+    vaEncodedView view)
+{
+    uint8 *bytes = view.bytes + vaFindEncodedValueLength(view.bytes);
+
+    return createElementView(bytes, view.end);
+}
+
+// Count the elements of a tuple or list, or the entries of a dictionary.  Version 2
+// containers record their count, so only version 1 containers are walked.
+uint64 vaEncodedViewCountElements(
+    vaEncodedView view)
+{
+    vaEncodedView element;
+    uint64 numElements = 0;
+    uint8 *end;
+
+    vaFindEncodedElements(view.bytes, &end, &numElements);
+    if(end != NULL) {
+        return numElements;
+    }
+    vaForeachEncodedViewElement(view, element) {
+        numElements++;
+    } vaEndEncodedViewElement;
+    if(*view.bytes == 'd') {
+        return numElements >> 1;
+    }
+    return numElements;
+}
+
+// Return a view of the element of a tuple or list at the index, or a null view if the
+// index is out of range.
+vaEncodedView vaEncodedViewGetiElement(
+    vaEncodedView view,
+    uint64 index)
+{
+    vaEncodedView element;
+
+    vaForeachEncodedViewElement(view, element) {
+        if(index-- == 0) {
+            return element;
+        }
+    } vaEndEncodedViewElement;
+    return vaEncodedViewCreate(NULL);
+}
+
+// Find the value for a key in a dictionary, where the key is itself encoded.  Keys are
+// compared by their encoded bytes.  Return a null view if the key is not there.
+vaEncodedView vaEncodedViewFindKey(
+    vaEncodedView view,
+    uint8 *encodedKey)
+{
+    uint64 keyLength = vaFindEncodedValueLength(encodedKey);
+    vaEncodedView key = vaEncodedViewGetFirst(view);
+
+    while(key.bytes != NULL) {
+        if(vaFindEncodedValueLength(key.bytes) == keyLength &&
+                !memcmp(key.bytes, encodedKey, keyLength)) {
+            return vaEncodedViewGetNext(key);
+        }
+        key = vaEncodedViewGetNext(vaEncodedViewGetNext(key));
+    }
+    return key;
+}
+
+// Find the value for a string or ident key in a dictionary.  Return a null view if the key
+// is not there.
+static vaEncodedView findTextKey(
+    vaEncodedView view,
+    vaType type,
+    char *text)
+{
+    vaEncodedView key = vaEncodedViewGetFirst(view);
+
+    while(key.bytes != NULL) {
+        if(vaEncodedViewGetType(key) == type &&
+                !strcmp((char *)vaFindEncodedText(key.bytes), text)) {
+            return vaEncodedViewGetNext(key);
+        }
+        key = vaEncodedViewGetNext(vaEncodedViewGetNext(key));
+    }
+    return key;
+}
+
+// Find the value for a string key in a dictionary.
+vaEncodedView vaEncodedViewFindString(
+    vaEncodedView view,
+    char *text)
+{
+    return findTextKey(view, VA_STRING, text);
+}
+
+// Find the value for an ident key in a dictionary.
+vaEncodedView vaEncodedViewFindIdent(
+    vaEncodedView view,
+    char *name)
+{
+    return findTextKey(view, VA_IDENT, name);
+}
+
+// Return true if the zero-terminated text matches the key from start to end in a path,
+// where a backslash escapes the next character.  A backslash ending the key stands for
+// itself.
+static bool pathKeyMatches(
+    uchar *text,
+    char *start,
+    char *end)
+{
+    while(start < end) {
+        if(*start == '\\' && start + 1 < end) {
+            start++;
+        }
+        if(*text++ != (uchar)*start++) {
+            return false;
+        }
+    }
+    return *text == '\0';
+}
+
+// Find the value for a key in a path.  String keys match, and so do ident keys unless the
+// key was quoted.  Return a null view if the view is not a dictionary, or the key is not
+// there.
+static vaEncodedView findPathKey(
+    vaEncodedView view,
+    char *start,
+    char *end,
+    bool quoted)
+{
+    vaEncodedView key;
+    vaType type;
+
+    if(vaEncodedViewGetType(view) != VA_DICTIONARY) {
+        return vaEncodedViewCreate(NULL);
+    }
+    key = vaEncodedViewGetFirst(view);
+    while(key.bytes != NULL) {
+        type = vaEncodedViewGetType(key);
+        if((type == VA_STRING || (type == VA_IDENT && !quoted)) &&
+                pathKeyMatches(vaFindEncodedText(key.bytes), start, end)) {
+            return vaEncodedViewGetNext(key);
+        }
+        key = vaEncodedViewGetNext(vaEncodedViewGetNext(key));
+    }
+    return key;
+}
+
+// Find the element of a tuple or list at the index in a path.  Return a null view if the view
+// is not a tuple or list, or the index is out of range.
+static vaEncodedView findPathElement(
+    vaEncodedView view,
+    uint64 index)
+{
+    vaType type = vaEncodedViewGetType(view);
+
+    if(type != VA_TUPLE && type != VA_LIST) {
+        return vaEncodedViewCreate(NULL);
+    }
+    return vaEncodedViewGetiElement(view, index);
+}
+
+// Follow the path from the viewed value, and return a view of the value it leads to, or a
+// null view if there is none.  Nothing is decoded or allocated.  Exits if the path is not
+// well formed.
+vaEncodedView vaEncodedQuery(
+    vaEncodedView view,
+    char *path)
+{
+    char *p = path;
+    char *start;
+    uint64 index;
+
+    while(*p != '\0' && view.bytes != NULL) {
+        if(*p == '[') {
+            p++;
+            if(*p == '"') {
+                start = ++p;
+                while(*p != '"') {
+                    if(*p == '\\' && p[1] != '\0') {
+                        p++;
+                    }
+                    if(*p == '\0') {
+                        utExit("Unterminated key in path %s", path);
+                    }
+                    p++;
+                }
+                view = findPathKey(view, start, p, true);
+                p++;
+            } else {
+                if(!isdigit((uchar)*p)) {
+                    utExit("Expected an index in path %s", path);
+                }
+                index = 0;
+                while(isdigit((uchar)*p)) {
+                    index = index*10 + *p++ - '0';
+                }
+                view = findPathElement(view, index);
+            }
+            if(*p != ']') {
+                utExit("Expected ] in path %s", path);
+            }
+            p++;
+        } else {
+            if(*p == '.') {
+                p++;
+            }
+            start = p;
+            while(*p != '\0' && *p != '.' && *p != '[') {
+                p++;
+            }
+            if(p == start) {
+                utExit("Expected a key in path %s", path);
+            }
+            view = findPathKey(view, start, p, false);
+        }
+    }
+    return view;
+}
+
+// Return the viewed integer or object reference, without its sign.
+uint64 vaEncodedViewGetUint(
+    vaEncodedView view)
+{
+    return vaDecodeUint(view.bytes);
+}
+
+// Return the viewed bool.
+bool vaEncodedViewGetBool(
+    vaEncodedView view)
+{
+    return *view.bytes == 'T';
+}
+
+// Return the viewed float or double as a double.
+double vaEncodedViewGetDouble(
+    vaEncodedView view)
+{
+    if(*view.bytes == 'f') {
+        return vaDecodeFloat(view.bytes + 1);
+    }
+    return vaDecodeDouble(view.bytes + 1);
+}
+
+// Return the text of the viewed string or ident.  It points into the encoded buffer.
+uchar *vaEncodedViewGetText(
+    vaEncodedView view)
+{
+    return vaFindEncodedText(view.bytes);
+}
+
+// Return the bytes of the viewed blob, which point into the encoded buffer.
+uint8 *vaEncodedViewGetBlob(
+    vaEncodedView view,
+    uint64 *length)
+{
+    *length = vaDecodeUint(view.bytes);
+    return view.bytes + (*view.bytes & 0x7) + 2;
+}
+
+// Decode the viewed value.
+vaValue vaEncodedViewMaterialize(
+    vaEncodedView view)
+{
+    return vaBdecode(view.bytes);
+}
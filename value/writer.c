@@ -0,0 +1,408 @@
+/* Streaming text writer.  Values are written to a sink as they are walked, so printing a
+   value needs only the sink's fixed-size buffer, however large the value is.  The writer
+   keeps no global state, so threads can write different values at once.
+
+   With a non-zero indent, the elements of non-empty tuples, lists and dictionaries go on
+   their own lines, indented that many spaces per level.  Either way, the text parses back
+   with vaParseValue. */
+
+#include <ctype.h>
+#include "value.h"
+
+#define VA_BLOB_CHUNK_SIZE 4096 // Bytes of a blob encoded at once
+
+typedef struct {
+    vaSink sink;
+    uint32 indent; // Spaces per level, or 0 to write on one line
+    uint32 depth;
+    bool hexFloats;
+} vaTextWriter;
+
+// Forward declaration for recursion.
+static void writeValue(vaTextWriter *writer, vaValue value);
+
+// Write a zero-terminated string without escaping it.
+static inline void writeText(
+    vaSink sink,
+    char *text)
+{
+    vaSinkWrite(sink, (uint8 *)text, strlen(text));
+}
+
+// Write an unsigned integer in decimal, or lowercase hex.
+static void writeUint(
+    vaSink sink,
+    uint64 value,
+    bool hex)
+{
+    char digits[20];
+    uint32 numDigits = 0;
+    uint32 digit;
+
+    do {
+        if(hex) {
+            digit = value & 0xf;
+            digits[numDigits++] = digit < 10? '0' + digit : 'a' + digit - 10;
+            value >>= 4;
+        } else {
+            digits[numDigits++] = '0' + value % 10;
+            value /= 10;
+        }
+    } while(value != 0);
+    while(numDigits != 0) {
+        vaSinkAddByte(sink, digits[--numDigits]);
+    }
+}
+
+// Write a control character escape.  Tabs, newlines and returns get their usual escapes,
+// and others are written as \%d.
+static void writeControlChar(
+    vaSink sink,
+    uchar c)
+{
+    vaSinkAddByte(sink, '\\');
+    if(c == '\t') {
+        vaSinkAddByte(sink, 't');
+    } else if(c == '\n') {
+        vaSinkAddByte(sink, 'n');
+    } else if(c == '\r') {
+        vaSinkAddByte(sink, 'r');
+    } else {
+        if(c >= 10) {
+            vaSinkAddByte(sink, c/10 + '0');
+            c -= (c/10)*10;
+        }
+        vaSinkAddByte(sink, c + '0');
+    }
+}
+
+// Write a quoted string, with backslashes before quotes and backslashes, and control
+// characters escaped.  Runs of characters that need no escape are written in one piece.
+void vaWriteString(
+    vaSink sink,
+    uchar *string)
+{
+    uchar *run = string;
+    uchar c;
+
+    vaSinkAddByte(sink, '"');
+    while((c = *string) != '\0') {
+        if(c < ' ' || c == '"' || c == '\\') {
+            vaSinkWrite(sink, run, string - run);
+            if(c < ' ') {
+                writeControlChar(sink, c);
+            } else {
+                vaSinkAddByte(sink, '\\');
+                vaSinkAddByte(sink, c);
+            }
+            run = string + 1;
+        }
+        string++;
+    }
+    vaSinkWrite(sink, run, string - run);
+    vaSinkAddByte(sink, '"');
+}
+
+// Write an ident, escaping anything that's not alnum or _.  Non-ASCII characters are
+// allowed without escapes.  Idents named true, false or null are escaped so they do not read
+// back as those values.
+void vaWriteIdent(
+    vaSink sink,
+    uchar *name)
+{
+    uchar c;
+    uint8 extra;
+
+    if(!strcmp((char *)name, "false") || !strcmp((char *)name, "true") ||
+            !strcmp((char *)name, "null")) {
+        vaSinkAddByte(sink, '\\');
+    }
+    while((c = *name++) != '\0') {
+        if(c < ' ') {
+            writeControlChar(sink, c);
+        } else {
+            if(!isalnum(c) && c != '_' && !(c & 0x80)) {
+                vaSinkAddByte(sink, '\\');
+            }
+            vaSinkAddByte(sink, c);
+            extra = utf8FindLength(c) - 1;
+            while(extra--) {
+                vaSinkAddByte(sink, *name++);
+            }
+        }
+    }
+}
+
+// Start a new line at the current depth, if pretty-printing.
+static void writeNewline(
+    vaTextWriter *writer)
+{
+    uint32 numSpaces = writer->indent*writer->depth;
+
+    if(writer->indent == 0) {
+        return;
+    }
+    vaSinkAddByte(writer->sink, '\n');
+    while(numSpaces--) {
+        vaSinkAddByte(writer->sink, ' ');
+    }
+}
+
+// Write the separator before an element, and start its line.
+static void startElement(
+    vaTextWriter *writer,
+    bool firstTime)
+{
+    if(!firstTime) {
+        vaSinkAddByte(writer->sink, ',');
+        if(writer->indent == 0) {
+            vaSinkAddByte(writer->sink, ' ');
+        }
+    }
+    writeNewline(writer);
+}
+
+// Write a tuple or list.
+static void writeList(
+    vaTextWriter *writer,
+    vaList list,
+    char *open,
+    char *close)
+{
+    vaValue value;
+    bool firstTime = true;
+
+    writeText(writer->sink, open);
+    writer->depth++;
+    vaForeachListValue(list, value) {
+        startElement(writer, firstTime);
+        firstTime = false;
+        writeValue(writer, value);
+    } vaEndListValue;
+    writer->depth--;
+    if(!firstTime) {
+        writeNewline(writer);
+    }
+    writeText(writer->sink, close);
+}
+
+// Write a dictionary.
+static void writeDictionary(
+    vaTextWriter *writer,
+    vaDictionary dictionary)
+{
+    uint32 xEntry;
+    bool firstTime = true;
+
+    writeText(writer->sink, "<|");
+    writer->depth++;
+    vaForeachDictionaryEntry(dictionary, xEntry) {
+        startElement(writer, firstTime);
+        firstTime = false;
+        writeValue(writer, vaDictionaryGetiKey(dictionary, xEntry));
+        writeText(writer->sink, writer->indent == 0? ":" : ": ");
+        writeValue(writer, vaDictionaryGetiValue(dictionary, xEntry));
+    } vaEndDictionaryEntry;
+    writer->depth--;
+    if(!firstTime) {
+        writeNewline(writer);
+    }
+    writeText(writer->sink, "|>");
+}
+
+// Write blob bytes as 0b followed by hex digits.
+static void writeBlob(
+    vaSink sink,
+    uint8 *bytes,
+    uint64 length)
+{
+    uint64 chunk;
+
+    writeText(sink, "0b");
+    // Encode straight into the sink's buffer, in chunks that fit in any sink.
+    while(length != 0) {
+        chunk = length < VA_BLOB_CHUNK_SIZE? length : VA_BLOB_CHUNK_SIZE;
+        if(sink->size - sink->used < chunk << 1) {
+            vaSinkMakeRoom(sink, chunk << 1);
+        }
+        vaHexEncode(bytes, chunk, sink->buffer + sink->used);
+        sink->used += chunk << 1;
+        bytes += chunk;
+        length -= chunk;
+    }
+}
+
+// Write a float or double.
+static void writeFloat(
+    vaTextWriter *writer,
+    vaValue value)
+{
+    char text[VA_MAX_FLOAT_TEXT];
+    uint32 length;
+
+    if(vaValueGetType(value) == VA_FLOAT) {
+        length = writer->hexFloats? vaFormatHexFloat(vaValueGetFloatVal(value), text) :
+            vaFormatFloat(vaValueGetFloatVal(value), text);
+    } else {
+        length = writer->hexFloats? vaFormatHexDouble(vaValueGetDoubleVal(value), text) :
+            vaFormatDouble(vaValueGetDoubleVal(value), text);
+    }
+    vaSinkWrite(writer->sink, (uint8 *)text, length);
+}
+
+// Write the value as text.
+static void writeValue(
+    vaTextWriter *writer,
+    vaValue value)
+{
+    vaSink sink = writer->sink;
+
+    switch(vaValueGetType(value)) {
+    case VA_POSINT:
+        writeUint(sink, vaValueGetUintVal(value), false);
+        break;
+    case VA_NEGINT:
+        vaSinkAddByte(sink, '-');
+        writeUint(sink, vaValueGetUintVal(value), false);
+        break;
+    case VA_OBJECT:
+        writeText(sink, "0p");
+        writeUint(sink, vaValueGetObjectVal(value), true);
+        break;
+    case VA_FLOAT: case VA_DOUBLE:
+        writeFloat(writer, value);
+        break;
+    case VA_STRING:
+        vaWriteString(sink, vaStringGetValue(vaValueGetStringVal(value)));
+        break;
+    case VA_BOOL:
+        writeText(sink, vaValueBoolVal(value)? "true" : "false");
+        break;
+    case VA_IDENT:
+        vaWriteIdent(sink, (uchar *)utSymGetName(vaValueGetNameVal(value)));
+        break;
+    case VA_TUPLE:
+        writeList(writer, vaValueGetTupleVal(value), "(", ")");
+        break;
+    case VA_LIST:
+        writeList(writer, vaValueGetListVal(value), "[", "]");
+        break;
+    case VA_NULL:
+        writeText(sink, "null");
+        break;
+    case VA_DICTIONARY:
+        writeDictionary(writer, vaValueGetDictionaryVal(value));
+        break;
+    case VA_BLOB:
+        writeBlob(sink, vaBlobGetValue(vaValueGetBlobVal(value)),
+            vaBlobGetLength(vaValueGetBlobVal(value)));
+        break;
+    default:
+        utExit("Unknown value type");
+    }
+}
+
+// Write the value as text to the sink.  A non-zero indent pretty-prints it, and hexFloats
+// writes floats in exact hex.  Nothing is flushed, so call vaSinkFlush when done.
+void vaWriteValue(
+    vaSink sink,
+    vaValue value,
+    uint32 indent,
+    bool hexFloats)
+{
+    vaTextWriter writer;
+
+    writer.sink = sink;
+    writer.indent = indent;
+    writer.depth = 0;
+    writer.hexFloats = hexFloats;
+    writeValue(&writer, value);
+}
+
+// Write the elements of an encoded tuple, list or dictionary, separated by commas.
+// Dictionary keys and values are separated by colons.
+static void writeEncodedElements(
+    vaSink sink,
+    vaEncodedView view)
+{
+    vaEncodedView element;
+    bool isDictionary = vaEncodedViewGetType(view) == VA_DICTIONARY;
+    bool isKey = true;
+    bool firstTime = true;
+
+    vaForeachEncodedViewElement(view, element) {
+        if(!firstTime) {
+            writeText(sink, isDictionary && !isKey? ":" : ", ");
+        }
+        firstTime = false;
+        vaWriteEncodedValue(sink, element.bytes);
+        isKey = !isKey;
+    } vaEndEncodedViewElement;
+}
+
+// Write an encoded value as text, reading it in place, so nothing is decoded or allocated.
+// The text is the same as vaWriteValue writes on one line.
+void vaWriteEncodedValue(
+    vaSink sink,
+    uint8 *bytes)
+{
+    vaEncodedView view = vaEncodedViewCreate(bytes);
+    char text[VA_MAX_FLOAT_TEXT];
+    uint8 *blob;
+    uint64 length;
+
+    switch(vaEncodedViewGetType(view)) {
+    case VA_POSINT:
+        writeUint(sink, vaEncodedViewGetUint(view), false);
+        break;
+    case VA_NEGINT:
+        vaSinkAddByte(sink, '-');
+        writeUint(sink, vaEncodedViewGetUint(view), false);
+        break;
+    case VA_OBJECT:
+        writeText(sink, "0p");
+        writeUint(sink, vaEncodedViewGetUint(view), true);
+        break;
+    case VA_FLOAT:
+        length = vaFormatFloat(vaDecodeFloat(bytes + 1), text);
+        vaSinkWrite(sink, (uint8 *)text, length);
+        break;
+    case VA_DOUBLE:
+        length = vaFormatDouble(vaDecodeDouble(bytes + 1), text);
+        vaSinkWrite(sink, (uint8 *)text, length);
+        break;
+    case VA_STRING:
+        vaWriteString(sink, vaEncodedViewGetText(view));
+        break;
+    case VA_BOOL:
+        writeText(sink, vaEncodedViewGetBool(view)? "true" : "false");
+        break;
+    case VA_IDENT:
+        vaWriteIdent(sink, vaEncodedViewGetText(view));
+        break;
+    case VA_TUPLE:
+        vaSinkAddByte(sink, '(');
+        writeEncodedElements(sink, view);
+        vaSinkAddByte(sink, ')');
+        break;
+    case VA_LIST:
+        vaSinkAddByte(sink, '[');
+        writeEncodedElements(sink, view);
+        vaSinkAddByte(sink, ']');
+        break;
+    case VA_NULL:
+        writeText(sink, "null");
+        break;
+    case VA_DICTIONARY:
+        writeText(sink, "<|");
+        writeEncodedElements(sink, view);
+        writeText(sink, "|>");
+        break;
+    case VA_BLOB:
+        blob = vaEncodedViewGetBlob(view, &length);
+        writeBlob(sink, blob, length);
+        break;
+    default:
+        utExit("Unknown value type");
+    }
+}